@@ -21,40 +21,82 @@
 #include "charger_algo.h"
 #include "charger_hwintf.h"
 #include "charger_manager.h"
+#include "charger_statemachine.h"
+#include <inttypes.h>
+#include <sys/param.h>
 
 /****************************************************************************
  * Pre-processor Definitions
  ****************************************************************************/
-#define BIT(n) (1U << (n))
 #define BUCK_ALGO_INIT_VOL 3000
 #define MAX_ALGO_NUM 5
 
-#define VBAT_OVP_MASK BIT(0)
-#define IBAT_OCP_MASK BIT(1)
-#define VBUS_OVP_MASK BIT(2)
-#define IBUS_OCP_MASK BIT(3)
-#define IBUS_UCP_MASK BIT(4)
-#define ADAPTER_INSERT_MASK BIT(5)
-#define VBAT_INSERT_MASK BIT(6)
-#define ADC_DONE_MASK BIT(7)
-#define VBUS_ERRORLO_STAT_MASK BIT(8)
-#define VBUS_ERRORHI_STAT_MASK BIT(9)
-#define CP_SWITCHING_STAT_MASK BIT(10)
-#define CHG_EN_STAT_MASK BIT(11)
+#define VBUS_SAG_MASK (VBUS_ERRORLO_STAT_MASK | IBUS_UCP_MASK)
+#define AICL_BACKOFF_HOLD_MS 500
+
+#define PUMP_OFFSET_CACHE_MAX 16
+#define PUMP_OFFSET_BUCKET_MV 100
 
 /****************************************************************************
  * Private Types
  ****************************************************************************/
 
+enum pump_start_step {
+    PUMP_START_IDLE,
+    PUMP_START_PROBE,
+    PUMP_START_ENABLE,
+    PUMP_START_RESTART,
+};
+
+struct pump_offset_entry {
+    int protocol;
+    int bucket;
+    int offset;
+};
+
+/* settling time and overshoot of the current after each new target */
+
+struct pump_regulator_metric {
+    uint64_t target_us;
+    uint64_t band_us;
+    int target;
+    int overshoot;
+    unsigned int in_band;
+    bool settled;
+};
+
+struct pump_algo_data {
+    enum pump_start_step step;
+    int vbase;
+    int vout_lo;
+    int vout_hi;
+    int vout;
+    int vout_min;
+    int vout_ref;
+    int64_t integral;
+    int last_current;
+    struct pump_regulator_metric metric;
+    bool adc_valid;
+    unsigned int adc_mismatches;
+    uint64_t deadline_us;
+    uint64_t start_us;
+    unsigned int probes;
+    unsigned int starts;
+    unsigned int total_probes;
+};
+
 /****************************************************************************
  * Private Function Prototypes
  ****************************************************************************/
 
 static int buck_algo_start(struct charger_algo* algo);
 static int buck_algo_update(struct charger_algo* algo, struct charger_plot_parameter* pa);
+static int buck_algo_regulate(struct charger_algo* algo);
 static int buck_algo_stop(struct charger_algo* algo);
 static int pump_algo_start(struct charger_algo* algo);
+static int pump_algo_poll(struct charger_algo* algo);
 static int pump_algo_update(struct charger_algo* algo, struct charger_plot_parameter* pa);
+static int pump_algo_regulate(struct charger_algo* algo);
 static int pump_algo_stop(struct charger_algo* algo);
 
 /****************************************************************************
@@ -64,15 +106,27 @@ static int pump_algo_stop(struct charger_algo* algo);
 static struct charger_algo_ops buck_algo = {
     .start = buck_algo_start,
     .update = buck_algo_update,
+    .regulate = buck_algo_regulate,
     .stop = buck_algo_stop,
 };
 
 static struct charger_algo_ops pump_algo = {
     .start = pump_algo_start,
+    .poll = pump_algo_poll,
     .update = pump_algo_update,
+    .regulate = pump_algo_regulate,
     .stop = pump_algo_stop,
+    .battery_feedback = true,
 };
 
+static struct pump_algo_data g_pump_algo_data[MAX_CHARGERS];
+
+/* most recently used first */
+
+static struct pump_offset_entry g_pump_offset_cache[PUMP_OFFSET_CACHE_MAX];
+static int g_pump_offset_entries = 0;
+static bool g_pump_offset_loaded = false;
+
 static struct charger_algo_class algo_tlbs[MAX_ALGO_NUM] = {
     { "buck", &buck_algo },
     { "pump", &pump_algo },
@@ -87,12 +141,66 @@ static int is_pa_changed(struct charger_plot_parameter* spa, struct charger_plot
     return memcmp(spa, dpa, sizeof(struct charger_plot_parameter));
 }
 
+static int input_limit_get(struct charger_algo* algo, int target)
+{
+    struct charger_manager* manager = algo->cm;
+    int limit;
+
+    if (!manager->desc.aicl.enable || manager->protocol < 0 || manager->protocol >= MAX_PROTOCOLS) {
+        return target;
+    }
+
+    limit = manager->aicl.limit[algo->index][manager->protocol];
+    return limit > 0 ? MIN(limit, target) : target;
+}
+
+static int input_limit_update(struct charger_algo* algo, unsigned int state, int target)
+{
+    struct charger_manager* manager = algo->cm;
+    struct charger_aicl_parameter* param = &manager->desc.aicl;
+    struct input_current_limit* aicl = &manager->aicl;
+    uint64_t now;
+    int* limit;
+
+    if (!param->enable || manager->protocol < 0 || manager->protocol >= MAX_PROTOCOLS || target <= 0) {
+        return target;
+    }
+
+    limit = &aicl->limit[algo->index][manager->protocol];
+    now = charger_get_time_us();
+
+    /*
+     * Back off below the current that made the bus sag. The flags stay up
+     * until the adapter has recovered, so back off once per hold time.
+     */
+
+    if (state & VBUS_SAG_MASK) {
+        if (now >= aicl->backoff_us[algo->index]) {
+            *limit = MAX(input_limit_get(algo, target) - param->step_dec, param->current_min);
+            aicl->backoff_us[algo->index] = now + AICL_BACKOFF_HOLD_MS * 1000ULL;
+            aicl->probe_us[algo->index] = now + param->probe_interval_ms * 1000ULL;
+            chargerwarn("charger %d bus sagged (0x%X), input limit %d mA for protocol %d\n",
+                algo->index, state, *limit, manager->protocol);
+        }
+        return input_limit_get(algo, target);
+    }
+
+    /* probe back up slowly, the sag may have been a transient */
+
+    if (*limit > 0 && *limit < target && now >= aicl->probe_us[algo->index]) {
+        *limit = MIN(*limit + param->step_inc, target);
+        aicl->probe_us[algo->index] = now + param->probe_interval_ms * 1000ULL;
+        chargerdebug("charger %d probes input limit %d mA\n", algo->index, *limit);
+    }
+    return input_limit_get(algo, target);
+}
+
 static int buck_algo_start(struct charger_algo* algo)
 {
     int ret;
 
     chargerinfo("buck algo start\n");
-    if (is_supply_exist()) {
+    if (is_supply_exist() && !algo->shared) {
         ret = set_supply_voltage(algo->cm, BUCK_ALGO_INIT_VOL);
         if (ret < 0) {
             chargererr("set supply voltage %d failed\n", BUCK_ALGO_INIT_VOL);
@@ -129,7 +237,7 @@ static int buck_algo_update(struct charger_algo* algo, struct charger_plot_param
             pa->vol_range_min, pa->vol_range_max, pa->charger_index,
             pa->work_current, pa->supply_vol);
 
-        ret = set_charger_current(algo->cm, pa->charger_index, pa->work_current);
+        ret = set_charger_current(algo->cm, pa->charger_index, input_limit_get(algo, pa->work_current));
         if (ret < 0) {
             chargererr("enable charger %d failed\n", algo->index);
             return CHARGER_FAILED;
@@ -149,6 +257,30 @@ static int buck_algo_update(struct charger_algo* algo, struct charger_plot_param
     return CHARGER_OK;
 }
 
+static int buck_algo_regulate(struct charger_algo* algo)
+{
+    struct charger_manager* manager = algo->cm;
+    unsigned int state = 0;
+    int current;
+
+    /* the buck only regulates its input current limit */
+
+    if (!manager->desc.aicl.enable || algo->sp.work_current <= 0) {
+        return CHARGER_OK;
+    }
+
+    if (get_charger_state(manager, algo->index, &state) < 0) {
+        return CHARGER_FAILED;
+    }
+
+    current = input_limit_update(algo, state, algo->sp.work_current);
+    if (set_charger_current(manager, algo->index, current) < 0) {
+        chargererr("set charger %d current %d failed\n", algo->index, current);
+        return CHARGER_FAILED;
+    }
+    return CHARGER_OK;
+}
+
 static int buck_algo_stop(struct charger_algo* algo)
 {
     struct charger_manager* manager = algo->cm;
@@ -161,7 +293,7 @@ static int buck_algo_stop(struct charger_algo* algo)
         return CHARGER_FAILED;
     }
 
-    if (is_supply_exist()) {
+    if (is_supply_exist() && !algo->shared) {
         ret = set_supply_voltage(manager, BUCK_ALGO_INIT_VOL);
         if (ret < 0) {
             chargererr("set supply %d failed\n", BUCK_ALGO_INIT_VOL);
@@ -172,72 +304,529 @@ static int buck_algo_stop(struct charger_algo* algo)
     return CHARGER_OK;
 }
 
+static struct pump_algo_data* pump_algo_get_data(struct charger_algo* algo)
+{
+    if (algo->priv == NULL) {
+        algo->priv = &g_pump_algo_data[algo->index];
+    }
+    return algo->priv;
+}
+
+static void pump_offset_load(void)
+{
+    struct pump_offset_entry entry;
+    FILE* file;
+
+    g_pump_offset_loaded = true;
+    if (CONFIG_CHARGERD_PUMP_OFFSET_FILE_PATH[0] == '\0') {
+        return;
+    }
+
+    file = fopen(CONFIG_CHARGERD_PUMP_OFFSET_FILE_PATH, "r");
+    if (file == NULL) {
+        chargerinfo("no learned pump offsets in %s\n", CONFIG_CHARGERD_PUMP_OFFSET_FILE_PATH);
+        return;
+    }
+
+    while (g_pump_offset_entries < PUMP_OFFSET_CACHE_MAX
+        && fscanf(file, "%d %d %d", &entry.protocol, &entry.bucket, &entry.offset) == 3) {
+        g_pump_offset_cache[g_pump_offset_entries++] = entry;
+    }
+    fclose(file);
+    chargerinfo("loaded %d learned pump offsets\n", g_pump_offset_entries);
+}
+
+static void pump_offset_save(void)
+{
+    FILE* file;
+    int i;
+
+    if (CONFIG_CHARGERD_PUMP_OFFSET_FILE_PATH[0] == '\0') {
+        return;
+    }
+
+    file = fopen(CONFIG_CHARGERD_PUMP_OFFSET_FILE_PATH, "w");
+    if (file == NULL) {
+        chargererr("Failed to open file %s\n", CONFIG_CHARGERD_PUMP_OFFSET_FILE_PATH);
+        return;
+    }
+
+    for (i = 0; i < g_pump_offset_entries; i++) {
+        fprintf(file, "%d %d %d\n", g_pump_offset_cache[i].protocol,
+            g_pump_offset_cache[i].bucket, g_pump_offset_cache[i].offset);
+    }
+    fclose(file);
+}
+
+static struct pump_offset_entry* pump_offset_find(int protocol, int vbase)
+{
+    int bucket = vbase / PUMP_OFFSET_BUCKET_MV;
+    int i;
+
+    if (!g_pump_offset_loaded) {
+        pump_offset_load();
+    }
+
+    for (i = 0; i < g_pump_offset_entries; i++) {
+        if (g_pump_offset_cache[i].protocol == protocol
+            && g_pump_offset_cache[i].bucket == bucket) {
+            return &g_pump_offset_cache[i];
+        }
+    }
+    return NULL;
+}
+
+static void pump_offset_learn(int protocol, int vbase, int offset)
+{
+    struct pump_offset_entry entry;
+    struct pump_offset_entry* found;
+    bool changed;
+    int i;
+
+    found = pump_offset_find(protocol, vbase);
+    changed = found == NULL || found->offset != offset;
+
+    /* move the key to the front on every use, the least recently used entry drops out */
+
+    entry.protocol = protocol;
+    entry.bucket = vbase / PUMP_OFFSET_BUCKET_MV;
+    entry.offset = offset;
+    if (found != NULL) {
+        i = found - g_pump_offset_cache;
+    } else if (g_pump_offset_entries < PUMP_OFFSET_CACHE_MAX) {
+        i = g_pump_offset_entries++;
+    } else {
+        i = PUMP_OFFSET_CACHE_MAX - 1;
+    }
+    memmove(&g_pump_offset_cache[1], &g_pump_offset_cache[0], i * sizeof(struct pump_offset_entry));
+    g_pump_offset_cache[0] = entry;
+
+    /* a hit only reorders, the file gets the order with the next new offset */
+
+    if (!changed) {
+        return;
+    }
+
+    chargerinfo("learned pump offset %d for protocol %d vbase %d\n", offset, protocol, vbase);
+    pump_offset_save();
+}
+
+static int pump_algo_fault(struct charger_algo* algo, unsigned int state)
+{
+    struct charger_manager* manager = algo->cm;
+
+    /* bits of reads that were handled, e.g. a sag AICL backed off, stay out */
+
+    manager->fault.state |= state & CHARGER_FAULT_MASK;
+    return CHARGER_FAILED;
+}
+
+static int pump_algo_wait(struct charger_algo* algo, unsigned int delay_ms)
+{
+    struct charger_manager* manager = algo->cm;
+    struct pump_algo_data* data = pump_algo_get_data(algo);
+
+    data->deadline_us = charger_get_time_us() + (uint64_t)delay_ms * 1000;
+    charger_timer_defer(manager->defer_fd, delay_ms);
+    return CHARGER_PENDING;
+}
+
+static int pump_algo_probe(struct charger_algo* algo, int rx_vout)
+{
+    struct pump_algo_data* data = pump_algo_get_data(algo);
+
+    if (set_supply_voltage(algo->cm, rx_vout) < 0) {
+        chargererr("set supply voltage %d failed\n", rx_vout);
+        return CHARGER_FAILED;
+    }
+    data->vout = rx_vout;
+    data->probes++;
+    return pump_algo_wait(algo, PUMP_CONF_STARTUP_PROBE_MS);
+}
+
+static int pump_algo_bisect(struct charger_algo* algo, unsigned int errstate)
+{
+    struct pump_algo_data* data = pump_algo_get_data(algo);
+    int steps;
+
+    /*
+     * VBUS_ERRORHI means the probe was above the valid window, otherwise
+     * it was below. Shrink the bracket and probe its middle on the 25 mV
+     * grid, the window is exhausted once the bracket is empty.
+     */
+
+    if (errstate & VBUS_ERRORHI_STAT_MASK && !(errstate & VBUS_ERRORLO_STAT_MASK)) {
+        data->vout_hi = data->vout - PUMP_CONF_STARTUP_VOLTAGE_OFFSET;
+    } else {
+        data->vout_lo = data->vout + PUMP_CONF_STARTUP_VOLTAGE_OFFSET;
+    }
+
+    if (data->vout_lo > data->vout_hi) {
+        chargererr("no valid rx_vout in window, last %d after %u probes\n",
+            data->vout, data->probes);
+        return CHARGER_FAILED;
+    }
+
+    steps = (data->vout_hi - data->vout_lo) / PUMP_CONF_STARTUP_VOLTAGE_OFFSET;
+    return pump_algo_probe(algo, data->vout_lo + steps / 2 * PUMP_CONF_STARTUP_VOLTAGE_OFFSET);
+}
+
 static int pump_algo_start(struct charger_algo* algo)
 {
+    struct charger_manager* manager = algo->cm;
+    struct pump_algo_data* data = pump_algo_get_data(algo);
+    struct pump_offset_entry* learned;
     int voltage = 0;
     int current = 0;
-    int vbase = 0;
-    int rx_vout = 0;
-    unsigned int errstate = 0;
-    unsigned int enstate = 0;
-    int psvc = 0;
-    int ret = 0;
+    int rx_vout;
 
     chargerinfo("pump algo start\n");
-    ret = get_battery_voltage(algo->cm, &voltage);
-    ret |= get_battery_current(algo->cm, &current);
-    if (ret < 0) {
-        chargererr("get battery info failed\n");
+    if (algo->shared) {
+        chargererr("pump regulates the supply, it can not share it\n");
         return CHARGER_FAILED;
     }
-    vbase = voltage - current * 0.25;
-    do {
-        rx_vout = vbase * 1.91 + PUMP_CONF_VOUT_OFFSET + (PUMP_CONF_STARTUP_VOLTAGE + PUMP_CONF_STARTUP_VOLTAGE_OFFSET * psvc);
-        if (rx_vout > PUMP_CONF_VOUT_MAX) {
-            chargererr("rx_vout = %d over %d\n", rx_vout, PUMP_CONF_VOUT_MAX);
-            return CHARGER_FAILED;
+
+    voltage = manager->snapshot.voltage;
+    current = manager->snapshot.current;
+    data->vbase = voltage - current * manager->snapshot.resistance / 1000;
+    data->vout_lo = data->vbase * 1.91 + PUMP_CONF_VOUT_OFFSET + PUMP_CONF_STARTUP_VOLTAGE;
+    data->vout_hi = PUMP_CONF_VOUT_MAX;
+    data->vout_min = data->vbase * 1.91 + PUMP_CONF_VOUT_OFFSET;
+    if (data->vout_lo > data->vout_hi) {
+        chargererr("rx_vout = %d over %d\n", data->vout_lo, PUMP_CONF_VOUT_MAX);
+        return CHARGER_FAILED;
+    }
+
+    data->probes = 0;
+    data->adc_valid = manager->desc.adc[algo->index].enable;
+    data->adc_mismatches = 0;
+    data->start_us = charger_get_time_us();
+    data->step = PUMP_START_PROBE;
+
+    /*
+     * Probe the offset learned for this adapter and battery voltage first,
+     * without one the lower edge is the usual answer.
+     */
+
+    rx_vout = data->vout_lo;
+    learned = pump_offset_find(manager->protocol, data->vbase);
+    if (learned != NULL) {
+        rx_vout = data->vbase * 1.91 + learned->offset;
+        if (rx_vout < data->vout_lo) {
+            rx_vout = data->vout_lo;
+        } else if (rx_vout > data->vout_hi) {
+            rx_vout = data->vout_hi;
         }
-        ret = set_supply_voltage(algo->cm, rx_vout);
-        usleep(1000 * 100);
-        ret |= get_charger_state(algo->cm, algo->index, &errstate);
-        if (ret < 0) {
-            chargererr("get charger error state failed\n");
-            return CHARGER_FAILED;
+    }
+
+    return pump_algo_probe(algo, rx_vout);
+}
+
+static int pump_algo_poll(struct charger_algo* algo)
+{
+    struct charger_manager* manager = algo->cm;
+    struct pump_algo_data* data = pump_algo_get_data(algo);
+    unsigned int state = 0;
+    uint64_t now;
+
+    now = charger_get_time_us();
+    if (now < data->deadline_us) {
+        charger_timer_defer(manager->defer_fd, (data->deadline_us - now + 999) / 1000);
+        return CHARGER_PENDING;
+    }
+
+    if (get_charger_state(algo->cm, algo->index, &state) < 0) {
+        chargererr("get charger error state failed\n");
+        goto fail;
+    }
+
+    switch (data->step) {
+    case PUMP_START_PROBE:
+        if (state & (VBUS_ERRORLO_STAT_MASK | VBUS_ERRORHI_STAT_MASK)) {
+            if (pump_algo_bisect(algo, state) < 0) {
+                goto fail;
+            }
+            return CHARGER_PENDING;
         }
-        psvc++;
-    } while (errstate & (VBUS_ERRORLO_STAT_MASK | VBUS_ERRORHI_STAT_MASK));
-    ret = enable_charger(algo->cm, algo->index, true);
-    usleep(1000 * 500);
-    ret |= get_charger_state(algo->cm, algo->index, &enstate);
-    enstate = enstate & CHG_EN_STAT_MASK;
-    if (ret < 0 || !enstate) {
-        enable_charger(algo->cm, algo->index, false);
-        return CHARGER_FAILED;
+        if (enable_charger(algo->cm, algo->index, true) < 0) {
+            goto fail;
+        }
+        data->step = PUMP_START_ENABLE;
+        return pump_algo_wait(algo, PUMP_CONF_STARTUP_ENABLE_MS);
+    case PUMP_START_ENABLE:
+        if (!(state & CHG_EN_STAT_MASK)) {
+            goto fail;
+        }
+        break;
+    case PUMP_START_RESTART:
+        if (pump_algo_start(algo) < 0) {
+            goto fail;
+        }
+        return CHARGER_PENDING;
+    default:
+        goto fail;
     }
 
+    data->step = PUMP_START_IDLE;
+    pump_offset_learn(manager->protocol, data->vbase, data->vout - (int)(data->vbase * 1.91));
+    data->starts++;
+    data->total_probes += data->probes;
+    chargerinfo("pump start rx_vout:%d probes:%u time:%" PRIu64 " ms (%u probes in %u starts)\n",
+        data->vout, data->probes, (charger_get_time_us() - data->start_us) / 1000,
+        data->total_probes, data->starts);
 #ifdef CONFIG_CHARGERD_SYNC_CHARGE_STATE
     set_battery_charge_state(algo->cm, BATTERY_CHARGING);
 #endif
 
     memset(&algo->sp, 0, sizeof(struct charger_plot_parameter));
     return CHARGER_OK;
+
+fail:
+    data->step = PUMP_START_IDLE;
+    enable_charger(algo->cm, algo->index, false);
+    return pump_algo_fault(algo, state);
 }
 
-static int pump_algo_update(struct charger_algo* algo, struct charger_plot_parameter* pa)
+static void pump_regulator_reset(struct charger_algo* algo, int target, int current)
+{
+    struct pump_algo_data* data = pump_algo_get_data(algo);
+
+    /* restart around the voltage in use, so a new target is bumpless */
+
+    data->vout_ref = data->vout;
+    data->integral = 0;
+    data->last_current = current;
+
+    memset(&data->metric, 0, sizeof(struct pump_regulator_metric));
+    data->metric.target = target;
+    data->metric.target_us = charger_get_time_us();
+}
+
+static void pump_regulator_account(struct charger_algo* algo, int current, int band)
+{
+    struct charger_manager* manager = algo->cm;
+    struct pump_regulator_metric* metric = &pump_algo_get_data(algo)->metric;
+
+    if (metric->settled) {
+        return;
+    }
+
+    if (current - metric->target > metric->overshoot) {
+        metric->overshoot = current - metric->target;
+    }
+
+    if (abs(current - metric->target) > band) {
+        metric->in_band = 0;
+        return;
+    }
+
+    if (metric->in_band++ == 0) {
+        metric->band_us = charger_get_time_us();
+    }
+    if (metric->in_band >= PUMP_CONF_SETTLE_COUNT) {
+        metric->settled = true;
+        chargerinfo("pump %s settled to %d mA in %" PRIu64 " ms, overshoot %d mA on the %s\n",
+            manager->desc.regulator[algo->index].enable ? "regulator" : "stepper",
+            metric->target, (metric->band_us - metric->target_us) / 1000, metric->overshoot,
+            pump_algo_get_data(algo)->adc_valid ? "adc" : "gauge");
+    }
+}
+
+static int pump_regulator_step(struct charger_algo* algo, int target, int current)
+{
+    struct charger_manager* manager = algo->cm;
+    struct charger_regulator_parameter* gain = &manager->desc.regulator[algo->index];
+    struct pump_algo_data* data = pump_algo_get_data(algo);
+    int64_t integral;
+    int64_t output;
+    int error;
+    int hi;
+    int lo;
+    int vol;
+
+    error = target - current;
+    integral = data->integral + (int64_t)gain->ki * error;
+
+    /* the derivative acts on the measurement, a new target does not kick it */
+
+    output = (int64_t)gain->kp * error + integral - (int64_t)gain->kd * (current - data->last_current);
+    data->last_current = current;
+
+    hi = MIN(data->vout + gain->step_inc_max, PUMP_CONF_VOUT_MAX);
+    lo = MAX(data->vout - gain->step_dec_max, data->vout_min);
+    vol = data->vout_ref + output / 1000;
+
+    /* stop integrating into a limit, the integrator never winds up */
+
+    if (vol > hi) {
+        vol = hi;
+        if (error < 0) {
+            data->integral = integral;
+        }
+    } else if (vol < lo) {
+        vol = lo;
+        if (error > 0) {
+            data->integral = integral;
+        }
+    } else {
+        data->integral = integral;
+    }
+
+    vol -= vol % PUMP_CONF_VOUT_STEP_INC;
+    if (vol == data->vout) {
+        return CHARGER_OK;
+    }
+
+    if (set_supply_voltage(algo->cm, vol) < 0) {
+        return CHARGER_FAILED;
+    }
+    data->vout = vol;
+    return CHARGER_OK;
+}
+
+static int pump_stepper_step(struct charger_algo* algo, int target, int current)
+{
+    int vol = 0;
+
+    if (current < (target - PUMP_CONF_COUT_STEP_DEC)) {
+        if (get_supply_voltage(algo->cm, &vol) < 0) {
+            return CHARGER_FAILED;
+        }
+        vol += PUMP_CONF_VOUT_STEP_INC;
+        if (vol > PUMP_CONF_VOUT_MAX) {
+            vol = PUMP_CONF_VOUT_MAX;
+        }
+        if (set_supply_voltage(algo->cm, vol) < 0) {
+            return CHARGER_FAILED;
+        }
+    }
+    if (current > (target + PUMP_CONF_COUT_STEP_INC)) {
+        if (get_supply_voltage(algo->cm, &vol) < 0) {
+            return CHARGER_FAILED;
+        }
+        vol -= PUMP_CONF_VOUT_STEP_DEC;
+        if (set_supply_voltage(algo->cm, vol) < 0) {
+            return CHARGER_FAILED;
+        }
+    }
+    return CHARGER_OK;
+}
+
+static int pump_algo_restart(struct charger_algo* algo)
+{
+    struct pump_algo_data* data = pump_algo_get_data(algo);
+
+    /* the flags of the sag stay up for a while, start once the bus recovered */
+
+    chargerwarn("pump %d stopped on a sagging bus, restart at %d mA\n", algo->index,
+        input_limit_get(algo, algo->sp.work_current));
+    if (pump_algo_stop(algo) < 0) {
+        return CHARGER_FAILED;
+    }
+    data->step = PUMP_START_RESTART;
+    return pump_algo_wait(algo, AICL_BACKOFF_HOLD_MS);
+}
+
+static int pump_algo_check(struct charger_algo* algo, unsigned int* state)
 {
-    unsigned int state = 0;
     unsigned int ovp;
     unsigned int enstate;
-    int current = 0;
-    int vol = 0;
-    int ret = 0;
+    int limit;
+    int ret;
+
+    *state = 0;
+    ret = get_charger_state(algo->cm, algo->index, state);
+    enstate = *state & CHG_EN_STAT_MASK;
+    ovp = *state & (VBAT_OVP_MASK | VBUS_OVP_MASK);
+    if (ret < 0 || !enstate || ovp) {
+
+        /* a collapsed bus may have stopped the pump, restart it lower */
+
+        if (ret == CHARGER_OK && (*state & VBUS_SAG_MASK)) {
+            limit = input_limit_get(algo, algo->sp.work_current);
+            if (input_limit_update(algo, *state, algo->sp.work_current) < limit && !ovp) {
+                return pump_algo_restart(algo);
+            }
+        }
+        return pump_algo_fault(algo, *state);
+    }
+    return CHARGER_OK;
+}
+
+static int pump_algo_feedback(struct charger_algo* algo, unsigned int state)
+{
+    struct charger_manager* manager = algo->cm;
+    struct charger_adc_parameter* param = &manager->desc.adc[algo->index];
+    struct pump_algo_data* data = pump_algo_get_data(algo);
+    struct charger_adc adc;
+
+    /* the gauge current is averaged over seconds, it is only the fallback */
+
+    if (!data->adc_valid || !(state & ADC_DONE_MASK)) {
+        return manager->snapshot.current;
+    }
+
+#ifdef CONFIG_CHARGERD_CHARGER_ADC
+    if (get_charger_adc(manager, algo->index, &adc) < 0) {
+        chargerwarn("pump adc unavailable, regulating on the gauge\n");
+        data->adc_valid = false;
+        return manager->snapshot.current;
+    }
+
+    /*
+     * The ADC sees the pump alone, the gauge the sum with a sharing charger.
+     * The setpoint of the sharing charger is no measure of it, its input
+     * limit may hold it back, so without its own ADC the gauge is used.
+     */
+
+    if (manager->sharing.primary == algo->index) {
+        struct charger_adc share;
+
+        if (!manager->desc.adc[manager->sharing.secondary].enable
+            || get_charger_adc(manager, manager->sharing.secondary, &share) < 0) {
+            return manager->snapshot.current;
+        }
+        adc.ibat += share.ibat;
+    }
+#else
+    return manager->snapshot.current;
+#endif
+
+    /*
+     * The gauge lags a new target and disagrees with the ADC until the
+     * current has settled, so only a settled current is cross-checked.
+     */
+
+    if (!data->metric.settled) {
+        return adc.ibat;
+    }
+
+    if (abs(adc.ibat - manager->snapshot.current) <= param->tolerance) {
+        data->adc_mismatches = 0;
+        return adc.ibat;
+    }
+
+    if (++data->adc_mismatches < param->mismatch_count) {
+        return adc.ibat;
+    }
+
+    chargerwarn("pump adc ibat %d mA disagrees with the gauge %d mA, regulating on the gauge\n",
+        adc.ibat, manager->snapshot.current);
+    data->adc_valid = false;
+    pump_regulator_reset(algo, data->metric.target, manager->snapshot.current);
+    return manager->snapshot.current;
+}
+
+static int pump_algo_update(struct charger_algo* algo, struct charger_plot_parameter* pa)
+{
+    unsigned int state;
+    int target;
+    int ret;
 
     if (pa) {
-        ret = get_charger_state(algo->cm, algo->index, &state);
-        enstate = state & CHG_EN_STAT_MASK;
-        ovp = state & (VBAT_OVP_MASK | VBUS_OVP_MASK);
-        if (ret < 0 || !enstate || ovp) {
-            return CHARGER_FAILED;
+        ret = pump_algo_check(algo, &state);
+        if (ret != CHARGER_OK) {
+            return ret;
         }
 
         if (is_pa_changed(&algo->sp, pa)) {
@@ -248,49 +837,70 @@ static int pump_algo_update(struct charger_algo* algo, struct charger_plot_param
                 pa->work_current, pa->supply_vol);
 
             memcpy(&algo->sp, pa, sizeof(struct charger_plot_parameter));
-            return set_charger_current(algo->cm, algo->index, pa->work_current);
-        } else {
-            ret = get_battery_current(algo->cm, &current);
-            chargerassert_return(ret < 0, "pump_algo_update get battery current failed\n");
+            target = input_limit_get(algo, pa->work_current);
+            pump_regulator_reset(algo, target, pump_algo_feedback(algo, state));
+            return set_charger_current(algo->cm, algo->index, target);
         }
+    }
+    return CHARGER_OK;
+}
 
-        if (current < (pa->work_current - PUMP_CONF_COUT_STEP_DEC)) {
-            if (get_supply_voltage(algo->cm, &vol) < 0) {
-                return CHARGER_FAILED;
-            }
-            vol += PUMP_CONF_VOUT_STEP_INC;
-            if (vol > PUMP_CONF_VOUT_MAX) {
-                vol = PUMP_CONF_VOUT_MAX;
-            }
-            if (set_supply_voltage(algo->cm, vol) < 0) {
-                return CHARGER_FAILED;
-            }
-        }
-        if (current > (pa->work_current + PUMP_CONF_COUT_STEP_INC)) {
-            if (get_supply_voltage(algo->cm, &vol) < 0) {
-                return CHARGER_FAILED;
-            }
-            vol -= PUMP_CONF_VOUT_STEP_DEC;
-            if (set_supply_voltage(algo->cm, vol) < 0) {
-                return CHARGER_FAILED;
-            }
+static int pump_algo_regulate(struct charger_algo* algo)
+{
+    struct charger_manager* manager = algo->cm;
+    struct charger_regulator_parameter* gain = &manager->desc.regulator[algo->index];
+    struct pump_algo_data* data = pump_algo_get_data(algo);
+    unsigned int state;
+    int current;
+    int target;
+    int ret;
+
+    /* nothing to track until update applied a plot */
+
+    if (algo->sp.work_current <= 0) {
+        return CHARGER_OK;
+    }
+
+    ret = pump_algo_check(algo, &state);
+    if (ret != CHARGER_OK) {
+        return ret;
+    }
+
+    current = pump_algo_feedback(algo, state);
+
+    /* the input limit moves the target below the plot on a weak adapter */
+
+    target = input_limit_update(algo, state, algo->sp.work_current);
+    if (target != data->metric.target) {
+        pump_regulator_reset(algo, target, current);
+        if (set_charger_current(algo->cm, algo->index, target) < 0) {
+            return CHARGER_FAILED;
         }
     }
-    return CHARGER_OK;
+
+    if (gain->enable) {
+        pump_regulator_account(algo, current, gain->settle_band);
+        return pump_regulator_step(algo, target, current);
+    }
+
+    pump_regulator_account(algo, current, PUMP_CONF_SETTLE_BAND);
+    return pump_stepper_step(algo, target, current);
 }
 
 static int pump_algo_stop(struct charger_algo* algo)
 {
+    struct pump_algo_data* data = pump_algo_get_data(algo);
     int ret;
 
     chargerinfo("pump algo stop\n");
+    data->step = PUMP_START_IDLE;
     ret = enable_charger(algo->cm, algo->index, false);
     if (ret < 0) {
         chargererr("disable charger %d failed\n", algo->index);
         return CHARGER_FAILED;
     }
 
-    if (is_supply_exist()) {
+    if (is_supply_exist() && !algo->shared) {
         ret = set_supply_voltage(algo->cm, PUMP_CONF_STARTUP_VOLTAGE);
         if (ret < 0) {
             chargererr("set supply %d failed\n", PUMP_CONF_STARTUP_VOLTAGE);
@@ -28,16 +28,348 @@
 #define MAX_NUM_CHARS 100
 #define MAX_NUM_PLOT_PARAMS 30
 
+/* tables share band edges, a larger grid means a misaligned table */
+
+#define MAX_PLOT_CELLS 16384
+
 /****************************************************************************
  * Private Functions
  ****************************************************************************/
 
+static int compare_int(const void* a, const void* b)
+{
+    int x = *(const int*)a;
+    int y = *(const int*)b;
+
+    return (x > y) - (x < y);
+}
+
+static void charger_plot_range(struct charger_plot_parameter* pa, int dim, int* min, int* max)
+{
+    switch (dim) {
+    case CHARGER_PLOT_DIM_TEMP:
+        *min = pa->temp_range_min;
+        *max = pa->temp_range_max;
+        break;
+    case CHARGER_PLOT_DIM_VOL:
+        *min = pa->vol_range_min;
+        *max = pa->vol_range_max;
+        break;
+    default:
+        *min = pa->axis_range_min;
+        *max = pa->axis_range_max;
+        break;
+    }
+}
+
+static int charger_plot_edges(struct charger_plot* plot, int dim, int** edges)
+{
+    int* buf;
+    int num = 0;
+    int min;
+    int max;
+    int i;
+    int j;
+
+    *edges = NULL;
+    if (plot->parameters <= 0) {
+        return 0;
+    }
+
+    /* the ranges are inclusive, a range ends on the edge after its max */
+
+    buf = (int*)malloc(2 * plot->parameters * sizeof(int));
+    if (buf == NULL) {
+        chargererr("alloc plot edges no memory\n");
+        return CHARGER_FAILED;
+    }
+    for (i = 0; i < plot->parameters; i++) {
+        charger_plot_range(plot->tlbs + i, dim, &min, &max);
+        buf[num++] = min;
+        buf[num++] = max + 1;
+    }
+
+    qsort(buf, num, sizeof(int), compare_int);
+    for (i = 1, j = 0; i < num; i++) {
+        if (buf[i] != buf[j]) {
+            buf[++j] = buf[i];
+        }
+    }
+
+    *edges = buf;
+    return j + 1;
+}
+
+static int charger_plot_cell(const int* edges, int cells, int value)
+{
+    int lo = 0;
+    int hi = cells - 1;
+    int mid;
+
+    if (cells <= 0 || value < edges[0] || value >= edges[cells]) {
+        return -1;
+    }
+
+    while (lo < hi) {
+        mid = (lo + hi + 1) / 2;
+        if (edges[mid] <= value) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return lo;
+}
+
+static int charger_plot_offset(struct charger_plot_index* index, const int* cell)
+{
+    return (cell[CHARGER_PLOT_DIM_TEMP] * index->cells[CHARGER_PLOT_DIM_VOL]
+               + cell[CHARGER_PLOT_DIM_VOL])
+        * index->cells[CHARGER_PLOT_DIM_AXIS]
+        + cell[CHARGER_PLOT_DIM_AXIS];
+}
+
+static struct charger_plot_parameter* charger_plot_row(struct charger_plot* plot, int temp, int vol, int axis)
+{
+    struct charger_plot_index* index = &plot->index;
+    int value[CHARGER_PLOT_DIMS] = { temp, vol, axis };
+    int cell[CHARGER_PLOT_DIMS];
+    int dim;
+    int row;
+
+    for (dim = 0; dim < CHARGER_PLOT_DIMS; dim++) {
+        cell[dim] = charger_plot_cell(index->edges[dim], index->cells[dim], value[dim]);
+        if (cell[dim] < 0) {
+            return NULL;
+        }
+    }
+    row = index->grid[charger_plot_offset(index, cell)];
+    return row < 0 ? NULL : plot->tlbs + row;
+}
+
+static int charger_plot_lerp(int a, int b, int64_t pos, int64_t span)
+{
+    if (span <= 0 || pos <= 0) {
+        return a;
+    }
+    if (pos >= span) {
+        return b;
+    }
+    return a + (int)((int64_t)(b - a) * pos / span);
+}
+
+static void charger_plot_index_free(struct charger_plot* plot)
+{
+    int dim;
+
+    for (dim = 0; dim < CHARGER_PLOT_DIMS; dim++) {
+        free(plot->index.edges[dim]);
+    }
+    free(plot->index.grid);
+    memset(&plot->index, 0, sizeof(struct charger_plot_index));
+}
+
+static void charger_plot_index_fill(struct charger_plot_index* index, const int* lo, const int* hi, int row)
+{
+    int cell[CHARGER_PLOT_DIMS];
+
+    for (cell[0] = lo[0]; cell[0] <= hi[0]; cell[0]++) {
+        for (cell[1] = lo[1]; cell[1] <= hi[1]; cell[1]++) {
+            for (cell[2] = lo[2]; cell[2] <= hi[2]; cell[2]++) {
+                index->grid[charger_plot_offset(index, cell)] = row;
+            }
+        }
+    }
+}
+
+static int charger_plot_index_build(struct charger_plot* plot)
+{
+    struct charger_plot_index* index = &plot->index;
+    int lo[CHARGER_PLOT_DIMS];
+    int hi[CHARGER_PLOT_DIMS];
+    int size = 1;
+    int min;
+    int max;
+    int num;
+    int dim;
+    int i;
+
+    for (dim = 0; dim < CHARGER_PLOT_DIMS; dim++) {
+        num = charger_plot_edges(plot, dim, &index->edges[dim]);
+        if (num < 0) {
+            goto fail;
+        }
+        index->cells[dim] = num > 0 ? num - 1 : 0;
+        index->last_cell[dim] = -1;
+        if (index->cells[dim] > 0 && size > MAX_PLOT_CELLS / index->cells[dim]) {
+            chargererr("plot mask 0x%x needs more than %d cells\n", plot->mask, MAX_PLOT_CELLS);
+            goto fail;
+        }
+        size *= index->cells[dim];
+    }
+
+    index->grid = (short*)malloc((size + 1) * sizeof(short));
+    if (index->grid == NULL) {
+        chargererr("alloc plot grid no memory\n");
+        goto fail;
+    }
+    for (i = 0; i < size; i++) {
+        index->grid[i] = -1;
+    }
+
+    /* fill in reverse, so the first matching row wins as in a linear scan */
+
+    for (i = plot->parameters - 1; i >= 0; i--) {
+        for (dim = 0; dim < CHARGER_PLOT_DIMS; dim++) {
+            charger_plot_range(plot->tlbs + i, dim, &min, &max);
+            lo[dim] = charger_plot_cell(index->edges[dim], index->cells[dim], min);
+            hi[dim] = charger_plot_cell(index->edges[dim], index->cells[dim], max);
+            if (lo[dim] < 0 || hi[dim] < lo[dim]) {
+                break;
+            }
+        }
+        if (dim < CHARGER_PLOT_DIMS) {
+            chargerwarn("plot row %d has an empty range\n", i);
+            continue;
+        }
+        charger_plot_index_fill(index, lo, hi, i);
+    }
+
+    chargerinfo("plot mask 0x%x: %d rows in %d x %d x %d cells\n", plot->mask, plot->parameters,
+        index->cells[CHARGER_PLOT_DIM_TEMP], index->cells[CHARGER_PLOT_DIM_VOL],
+        index->cells[CHARGER_PLOT_DIM_AXIS]);
+    return CHARGER_OK;
+
+fail:
+    charger_plot_index_free(plot);
+    return CHARGER_FAILED;
+}
+
+static void charger_plot_protocol_build(struct charger_desc* desc)
+{
+    int type;
+    int i;
+
+    for (type = 0; type < MAX_PROTOCOLS; type++) {
+        desc->plot_by_protocol[type] = -1;
+        for (i = 0; i < desc->plots; i++) {
+            if (desc->plot[i].mask & (1U << type)) {
+                desc->plot_by_protocol[type] = i;
+                break;
+            }
+        }
+    }
+}
+
+static void parse_derating_curve(cJSON* array, struct charger_derating_curve* curve)
+{
+    curve->num = 0;
+    if (array == NULL || !cJSON_IsArray(array)) {
+        return;
+    }
+
+    for (int i = 0; i < cJSON_GetArraySize(array) && curve->num < MAX_DERATING_POINTS; i++) {
+        cJSON* point = cJSON_GetArrayItem(array, i);
+        if (!cJSON_IsArray(point) || cJSON_GetArraySize(point) != 2) {
+            chargererr("derating point %d is not a [temp, percent] array\n", i);
+            continue;
+        }
+        curve->points[curve->num].temp = cJSON_GetArrayItem(point, 0)->valueint;
+        curve->points[curve->num].percent = cJSON_GetArrayItem(point, 1)->valueint;
+        if (curve->num > 0 && curve->points[curve->num].temp <= curve->points[curve->num - 1].temp) {
+            chargererr("derating points must rise in temperature\n");
+            continue;
+        }
+        curve->num++;
+    }
+}
+
+static void parse_charger_fallback(cJSON* table, struct charger_plot* plot, unsigned int retry_ms)
+{
+    cJSON* parameter;
+    int i;
+
+    for (i = 0; i < MAX_CHARGERS; i++) {
+        plot->fallback[i].charger_index = CHARGER_INDEX_INVAILD;
+    }
+    plot->fallback_retry_ms = retry_ms;
+
+    parameter = cJSON_GetObjectItem(table, "fallback_retry_ms");
+    if (parameter) {
+        plot->fallback_retry_ms = parameter->valueint;
+    }
+
+    parameter = cJSON_GetObjectItem(table, "fallback");
+    if (parameter == NULL) {
+        return;
+    }
+
+    for (parameter = parameter->child; parameter != NULL; parameter = parameter->next) {
+        cJSON *charger_index_p, *fallback_index_p, *work_current_p, *supply_vol_p;
+        charger_index_p = cJSON_GetObjectItem(parameter, "charger_index");
+        fallback_index_p = cJSON_GetObjectItem(parameter, "fallback_index");
+        work_current_p = cJSON_GetObjectItem(parameter, "work_current");
+        supply_vol_p = cJSON_GetObjectItem(parameter, "supply_vol");
+        if (charger_index_p && fallback_index_p && work_current_p && supply_vol_p
+            && charger_index_p->valueint >= 0 && charger_index_p->valueint < MAX_CHARGERS
+            && fallback_index_p->valueint >= 0 && fallback_index_p->valueint < MAX_CHARGERS
+            && fallback_index_p->valueint != charger_index_p->valueint) {
+            struct charger_fallback* fallback = &plot->fallback[charger_index_p->valueint];
+
+            fallback->charger_index = fallback_index_p->valueint;
+            fallback->work_current = work_current_p->valueint;
+            fallback->supply_vol = supply_vol_p->valueint;
+        } else {
+            chargererr("an element of the charger fallback is incomplete\n");
+        }
+    }
+}
+
+static void parse_charger_sharing(cJSON* table, struct charger_plot* plot)
+{
+    cJSON* parameter;
+    int i;
+
+    for (i = 0; i < MAX_CHARGERS; i++) {
+        plot->sharing[i].charger_index = CHARGER_INDEX_INVAILD;
+    }
+
+    parameter = cJSON_GetObjectItem(table, "current_sharing");
+    if (parameter == NULL) {
+        return;
+    }
+
+    for (parameter = parameter->child; parameter != NULL; parameter = parameter->next) {
+        cJSON *charger_index_p, *share_index_p, *percent_p, *temp_start_p, *temp_max_p;
+        charger_index_p = cJSON_GetObjectItem(parameter, "charger_index");
+        share_index_p = cJSON_GetObjectItem(parameter, "share_index");
+        percent_p = cJSON_GetObjectItem(parameter, "percent");
+        temp_start_p = cJSON_GetObjectItem(parameter, "temp_start");
+        temp_max_p = cJSON_GetObjectItem(parameter, "temp_max");
+        if (charger_index_p && share_index_p && percent_p && temp_start_p && temp_max_p
+            && charger_index_p->valueint >= 0 && charger_index_p->valueint < MAX_CHARGERS
+            && share_index_p->valueint >= 0 && share_index_p->valueint < MAX_CHARGERS
+            && share_index_p->valueint != charger_index_p->valueint
+            && percent_p->valueint > 0 && percent_p->valueint < 100) {
+            struct charger_sharing* sharing = &plot->sharing[charger_index_p->valueint];
+
+            sharing->charger_index = share_index_p->valueint;
+            sharing->percent = percent_p->valueint;
+            sharing->temp_start = temp_start_p->valueint;
+            sharing->temp_max = temp_max_p->valueint;
+        } else {
+            chargererr("an element of the current sharing is incomplete\n");
+        }
+    }
+}
+
 static int parse_charger_desc_config(struct charger_desc* desc)
 {
     long length;
     char* data;
     cJSON *root, *tmp_pointer, *battery_default_param, *charging_fault_arry, *charger_list;
-    cJSON* temp_term_volt_table;
+    cJSON *temp_term_volt_table, *regulator_arry, *ir_compensation, *thermal_derating;
+    cJSON *thermal_forecast, *sensor_filter_table, *adc_arry, *input_current_limit;
 
     FILE* file = fopen(CONFIG_CHARGER_CONFIGURATION_FILE_PATH, "r");
     if (!file) {
@@ -118,6 +450,14 @@ static int parse_charger_desc_config(struct charger_desc* desc)
     if (tmp_pointer) {
         desc->polling_interval_ms = tmp_pointer->valueint;
     }
+    tmp_pointer = cJSON_GetObjectItem(root, "regulate_interval_ms");
+    if (tmp_pointer) {
+        desc->regulate_interval_ms = tmp_pointer->valueint;
+    }
+    tmp_pointer = cJSON_GetObjectItem(root, "telemetry_stale_ms");
+    if (tmp_pointer) {
+        desc->telemetry_stale_ms = tmp_pointer->valueint;
+    }
     tmp_pointer = cJSON_GetObjectItem(root, "fullbatt_capacity");
     if (tmp_pointer) {
         desc->fullbatt_capacity = tmp_pointer->valueint;
@@ -134,6 +474,10 @@ static int parse_charger_desc_config(struct charger_desc* desc)
     if (tmp_pointer) {
         desc->fault_duration_ms = tmp_pointer->valueint;
     }
+    tmp_pointer = cJSON_GetObjectItem(root, "fault_backoff_ms");
+    if (tmp_pointer) {
+        desc->fault_backoff_ms = tmp_pointer->valueint;
+    }
     tmp_pointer = cJSON_GetObjectItem(root, "temp_min");
     if (tmp_pointer) {
         desc->temp_min = tmp_pointer->valueint;
@@ -269,9 +613,9 @@ static int parse_charger_desc_config(struct charger_desc* desc)
                             continue;
                         }
 
-                        int tmp_array[7];
+                        int tmp_array[9];
                         int item_size = cJSON_GetArraySize(parameter);
-                        for (int j = 0; j < item_size; j++) {
+                        for (int j = 0; j < item_size && j < 9; j++) {
                             cJSON* item = cJSON_GetArrayItem(parameter, j);
                             tmp_array[j] = item->valueint;
                             if (j == 6) {
@@ -282,6 +626,11 @@ static int parse_charger_desc_config(struct charger_desc* desc)
                                 tlbs[i].charger_index = tmp_array[4];
                                 tlbs[i].work_current = tmp_array[5];
                                 tlbs[i].supply_vol = tmp_array[6];
+                                tlbs[i].axis_range_min = INT_MIN;
+                                tlbs[i].axis_range_max = INT_MAX - 1;
+                            } else if (j == 8) {
+                                tlbs[i].axis_range_min = tmp_array[7];
+                                tlbs[i].axis_range_max = tmp_array[8];
                             }
                         }
                     }
@@ -289,7 +638,30 @@ static int parse_charger_desc_config(struct charger_desc* desc)
                     desc->plot[desc->plots].tlbs = tlbs;
                     desc->plot[desc->plots].parameters = element_num;
                     desc->plot[desc->plots].mask = cJSON_GetObjectItem(charger_plot_table_index, "mask")->valueint;
+                    tmp_pointer = cJSON_GetObjectItem(charger_plot_table_index, "axis");
+                    if (tmp_pointer && tmp_pointer->valuestring) {
+                        if (strcmp(tmp_pointer->valuestring, "soc") == 0) {
+                            desc->plot[desc->plots].axis = CHARGER_PLOT_AXIS_SOC;
+                        } else if (strcmp(tmp_pointer->valuestring, "cycle") == 0) {
+                            desc->plot[desc->plots].axis = CHARGER_PLOT_AXIS_CYCLE;
+                        } else {
+                            chargererr("unknown plot axis %s\n", tmp_pointer->valuestring);
+                        }
+                    }
+                    tmp_pointer = cJSON_GetObjectItem(charger_plot_table_index, "interpolation");
+                    if (tmp_pointer) {
+                        desc->plot[desc->plots].interpolation = tmp_pointer->valueint;
+                    }
+                    tmp_pointer = cJSON_GetObjectItem(charger_plot_table_index, "current_step");
+                    if (tmp_pointer) {
+                        desc->plot[desc->plots].current_step = tmp_pointer->valueint;
+                    }
+                    parse_charger_fallback(charger_plot_table_index, &desc->plot[desc->plots], desc->fault_duration_ms);
+                    parse_charger_sharing(charger_plot_table_index, &desc->plot[desc->plots]);
                     desc->plots++;
+                    if (charger_plot_index_build(&desc->plot[desc->plots - 1]) < 0) {
+                        goto fail;
+                    }
                 } else {
                     chargererr("The charging curve table named %s was not found.\n", name_ptr->valuestring);
                     free(tlbs);
@@ -344,6 +716,178 @@ static int parse_charger_desc_config(struct charger_desc* desc)
         }
     }
 
+    ir_compensation = cJSON_GetObjectItem(root, "ir_compensation");
+    if (ir_compensation != NULL) {
+        cJSON* parameter = ir_compensation->child;
+        if (parameter != NULL) {
+            cJSON *enable_p, *resistance_p, *resistance_min_p, *resistance_max_p, *compensation_max_p;
+            enable_p = cJSON_GetObjectItem(parameter, "enable");
+            resistance_p = cJSON_GetObjectItem(parameter, "resistance");
+            resistance_min_p = cJSON_GetObjectItem(parameter, "resistance_min");
+            resistance_max_p = cJSON_GetObjectItem(parameter, "resistance_max");
+            compensation_max_p = cJSON_GetObjectItem(parameter, "compensation_max");
+            if (enable_p && resistance_min_p && resistance_max_p && compensation_max_p) {
+                desc->ir.enable = enable_p->valueint;
+                desc->ir.resistance_min = resistance_min_p->valueint;
+                desc->ir.resistance_max = resistance_max_p->valueint;
+                desc->ir.compensation_max = compensation_max_p->valueint;
+                if (resistance_p) {
+                    desc->ir.resistance = resistance_p->valueint;
+                }
+            } else {
+                chargererr("an element of the ir compensation is incomplete\n");
+            }
+        }
+    }
+
+    input_current_limit = cJSON_GetObjectItem(root, "input_current_limit");
+    if (input_current_limit != NULL) {
+        cJSON* parameter = input_current_limit->child;
+        if (parameter != NULL) {
+            cJSON *enable_p, *step_dec_p, *step_inc_p, *probe_interval_ms_p, *current_min_p;
+            enable_p = cJSON_GetObjectItem(parameter, "enable");
+            step_dec_p = cJSON_GetObjectItem(parameter, "step_dec");
+            step_inc_p = cJSON_GetObjectItem(parameter, "step_inc");
+            probe_interval_ms_p = cJSON_GetObjectItem(parameter, "probe_interval_ms");
+            current_min_p = cJSON_GetObjectItem(parameter, "current_min");
+            if (enable_p && step_dec_p && step_inc_p && probe_interval_ms_p && current_min_p) {
+                desc->aicl.enable = enable_p->valueint;
+                desc->aicl.step_dec = step_dec_p->valueint;
+                desc->aicl.step_inc = step_inc_p->valueint;
+                desc->aicl.probe_interval_ms = probe_interval_ms_p->valueint;
+                desc->aicl.current_min = current_min_p->valueint;
+            } else {
+                chargererr("an element of the input current limit is incomplete\n");
+            }
+        }
+    }
+
+    thermal_derating = cJSON_GetObjectItem(root, "thermal_derating");
+    if (thermal_derating != NULL) {
+        cJSON* parameter = thermal_derating->child;
+        if (parameter != NULL) {
+            cJSON *enable_p, *current_step_p;
+            enable_p = cJSON_GetObjectItem(parameter, "enable");
+            current_step_p = cJSON_GetObjectItem(parameter, "current_step");
+            if (enable_p && current_step_p) {
+                desc->derating.enable = enable_p->valueint;
+                desc->derating.current_step = current_step_p->valueint;
+                parse_derating_curve(cJSON_GetObjectItem(parameter, "battery_curve"), &desc->derating.battery);
+                parse_derating_curve(cJSON_GetObjectItem(parameter, "skin_curve"), &desc->derating.skin);
+            } else {
+                chargererr("an element of the thermal derating is incomplete\n");
+            }
+        }
+    }
+
+    sensor_filter_table = cJSON_GetObjectItem(root, "sensor_filter_table");
+    if (sensor_filter_table != NULL) {
+        static const char* signals[CHARGER_FILTER_MAX] = { "temp", "skin", "voltage", "current" };
+        cJSON* parameter = sensor_filter_table->child;
+        while (parameter != NULL) {
+            cJSON *signal_p, *median_p, *ema_p;
+            int signal;
+            signal_p = cJSON_GetObjectItem(parameter, "signal");
+            median_p = cJSON_GetObjectItem(parameter, "median");
+            ema_p = cJSON_GetObjectItem(parameter, "ema");
+            if (signal_p && signal_p->valuestring && median_p && ema_p) {
+                for (signal = 0; signal < CHARGER_FILTER_MAX; signal++) {
+                    if (strcmp(signal_p->valuestring, signals[signal]) == 0) {
+                        break;
+                    }
+                }
+                if (signal < CHARGER_FILTER_MAX) {
+                    desc->filter[signal].median = median_p->valueint > MAX_FILTER_WINDOW
+                        ? MAX_FILTER_WINDOW
+                        : median_p->valueint;
+                    desc->filter[signal].ema = ema_p->valueint;
+                } else {
+                    chargererr("unknown filter signal %s\n", signal_p->valuestring);
+                }
+            } else {
+                chargererr("an element of the sensor filter table is incomplete\n");
+            }
+            parameter = parameter->next;
+        }
+    }
+
+    thermal_forecast = cJSON_GetObjectItem(root, "thermal_forecast");
+    if (thermal_forecast != NULL) {
+        cJSON* parameter = thermal_forecast->child;
+        if (parameter != NULL) {
+            cJSON *enable_p, *horizon_p, *margin_p, *current_min_p;
+            enable_p = cJSON_GetObjectItem(parameter, "enable");
+            horizon_p = cJSON_GetObjectItem(parameter, "horizon");
+            margin_p = cJSON_GetObjectItem(parameter, "margin");
+            current_min_p = cJSON_GetObjectItem(parameter, "current_min");
+            if (enable_p && horizon_p && margin_p && current_min_p) {
+                desc->forecast.enable = enable_p->valueint;
+                desc->forecast.horizon = horizon_p->valueint;
+                desc->forecast.margin = margin_p->valueint;
+                desc->forecast.current_min = current_min_p->valueint;
+            } else {
+                chargererr("an element of the thermal forecast is incomplete\n");
+            }
+        }
+    }
+
+    regulator_arry = cJSON_GetObjectItem(root, "charger_regulator_table");
+    if (regulator_arry != NULL) {
+        cJSON* parameter = regulator_arry->child;
+        while (parameter != NULL) {
+            cJSON *charger_index_p, *kp_p, *ki_p, *kd_p, *step_inc_max_p, *step_dec_max_p, *settle_band_p;
+            charger_index_p = cJSON_GetObjectItem(parameter, "charger_index");
+            kp_p = cJSON_GetObjectItem(parameter, "kp");
+            ki_p = cJSON_GetObjectItem(parameter, "ki");
+            kd_p = cJSON_GetObjectItem(parameter, "kd");
+            step_inc_max_p = cJSON_GetObjectItem(parameter, "step_inc_max");
+            step_dec_max_p = cJSON_GetObjectItem(parameter, "step_dec_max");
+            settle_band_p = cJSON_GetObjectItem(parameter, "settle_band");
+            if (charger_index_p && kp_p && ki_p && kd_p && step_inc_max_p && step_dec_max_p && settle_band_p
+                && charger_index_p->valueint >= 0 && charger_index_p->valueint < MAX_CHARGERS) {
+                struct charger_regulator_parameter* regulator = &desc->regulator[charger_index_p->valueint];
+
+                regulator->enable = 1;
+                regulator->kp = kp_p->valueint;
+                regulator->ki = ki_p->valueint;
+                regulator->kd = kd_p->valueint;
+                regulator->step_inc_max = step_inc_max_p->valueint;
+                regulator->step_dec_max = step_dec_max_p->valueint;
+                regulator->settle_band = settle_band_p->valueint;
+            } else {
+                chargererr("an element of the charger regulator table is incomplete\n");
+            }
+            parameter = parameter->next;
+        }
+    }
+
+    adc_arry = cJSON_GetObjectItem(root, "charger_adc_table");
+    if (adc_arry != NULL) {
+        cJSON* parameter = adc_arry->child;
+        while (parameter != NULL) {
+            cJSON *charger_index_p, *tolerance_p, *mismatch_count_p;
+            charger_index_p = cJSON_GetObjectItem(parameter, "charger_index");
+            tolerance_p = cJSON_GetObjectItem(parameter, "tolerance");
+            mismatch_count_p = cJSON_GetObjectItem(parameter, "mismatch_count");
+            if (charger_index_p && tolerance_p && mismatch_count_p && mismatch_count_p->valueint >= 0
+                && charger_index_p->valueint >= 0 && charger_index_p->valueint < MAX_CHARGERS) {
+                struct charger_adc_parameter* adc = &desc->adc[charger_index_p->valueint];
+
+#ifdef CONFIG_CHARGERD_CHARGER_ADC
+                adc->enable = 1;
+#else
+                chargerwarn("charger %d adc feedback needs CONFIG_CHARGERD_CHARGER_ADC\n",
+                    charger_index_p->valueint);
+#endif
+                adc->tolerance = tolerance_p->valueint;
+                adc->mismatch_count = mismatch_count_p->valueint;
+            } else {
+                chargererr("an element of the charger adc table is incomplete\n");
+            }
+            parameter = parameter->next;
+        }
+    }
+
     cJSON_Delete(root);
     free(data);
     return CHARGER_OK;
@@ -354,7 +898,9 @@ fail:
             free(desc->plot[i].tlbs);
             desc->plot[i].tlbs = NULL;
         }
+        charger_plot_index_free(&desc->plot[i]);
     }
+    desc->plots = 0;
     cJSON_Delete(root);
     free(data);
     return CHARGER_FAILED;
@@ -374,6 +920,7 @@ int charger_desc_init(struct charger_desc* desc)
         chargererr("failed to parse charging related parameters\n");
     }
 
+    charger_plot_protocol_build(desc);
     return ret;
 }
 
@@ -385,5 +932,108 @@ void charger_desc_unit(struct charger_desc* desc)
         if (desc->plot[i].parameters) {
             free(desc->plot[i].tlbs);
         }
+        charger_plot_index_free(&desc->plot[i]);
+    }
+}
+
+/****************************************************************************
+ * Name: charger_desc_index_plot
+ *
+ * Description:
+ *   compile the rows of a plot into its lookup grid, the configuration
+ *   parser does it for every plot it loads
+ *
+ * Input Parameters:
+ *   plot - the plot whose tlbs and parameters are filled in
+ *
+ * Returned Value:
+ *    Zero on success or a negated value on failure.
+ ****************************************************************************/
+
+int charger_desc_index_plot(struct charger_plot* plot)
+{
+    charger_plot_index_free(plot);
+    return charger_plot_index_build(plot);
+}
+
+struct charger_plot* charger_desc_find_plot(struct charger_desc* desc, int type)
+{
+    if (type < 0 || type >= MAX_PROTOCOLS || desc->plot_by_protocol[type] < 0) {
+        return NULL;
+    }
+    return &desc->plot[desc->plot_by_protocol[type]];
+}
+
+struct charger_plot_parameter* charger_desc_lookup_plot(struct charger_plot* plot, int temp, int vol, int axis)
+{
+    struct charger_plot_index* index = &plot->index;
+    int value[CHARGER_PLOT_DIMS] = { temp, vol, axis };
+    int cell[CHARGER_PLOT_DIMS];
+    int dim;
+    int row;
+
+    /* most lookups land in the cell of the previous one */
+
+    for (dim = 0; dim < CHARGER_PLOT_DIMS; dim++) {
+        cell[dim] = index->last_cell[dim];
+        if (cell[dim] < 0 || value[dim] < index->edges[dim][cell[dim]]
+            || value[dim] >= index->edges[dim][cell[dim] + 1]) {
+            cell[dim] = charger_plot_cell(index->edges[dim], index->cells[dim], value[dim]);
+            if (cell[dim] < 0) {
+                return NULL;
+            }
+        }
+    }
+
+    memcpy(index->last_cell, cell, sizeof(cell));
+    row = index->grid[charger_plot_offset(index, cell)];
+    return row < 0 ? NULL : plot->tlbs + row;
+}
+
+int charger_desc_interpolate_plot(struct charger_plot* plot, struct charger_plot_parameter* pa,
+    int temp, int vol, int axis)
+{
+    struct charger_plot_parameter *nt, *nv, *nd;
+    int64_t ct, cv, nct, ncv;
+    int t, v;
+    int lo, hi;
+    int current;
+
+    /*
+     * Every row value sits at the centre of its range. Interpolate towards
+     * the rows next to it on the side of the point, a row that drives
+     * another charger or none is not blended, the current stays a step
+     * there. The third axis is not blended.
+     */
+
+    ct = ((int64_t)pa->temp_range_min + pa->temp_range_max) / 2;
+    cv = ((int64_t)pa->vol_range_min + pa->vol_range_max) / 2;
+    t = temp >= ct ? pa->temp_range_max + 1 : pa->temp_range_min - 1;
+    v = vol >= cv ? pa->vol_range_max + 1 : pa->vol_range_min - 1;
+
+    nt = charger_plot_row(plot, t, vol, axis);
+    if (nt == NULL || nt->charger_index != pa->charger_index) {
+        nt = pa;
+    }
+    nv = charger_plot_row(plot, temp, v, axis);
+    if (nv == NULL || nv->charger_index != pa->charger_index) {
+        nv = pa;
+    }
+    nd = charger_plot_row(plot, t, v, axis);
+    if (nd == NULL || nd->charger_index != pa->charger_index) {
+        nd = nv;
+    }
+
+    nct = ((int64_t)nt->temp_range_min + nt->temp_range_max) / 2;
+    ncv = ((int64_t)nv->vol_range_min + nv->vol_range_max) / 2;
+    lo = charger_plot_lerp(pa->work_current, nt->work_current, llabs(temp - ct), llabs(nct - ct));
+    hi = charger_plot_lerp(nv->work_current, nd->work_current, llabs(temp - ct), llabs(nct - ct));
+    current = charger_plot_lerp(lo, hi, llabs(vol - cv), llabs(ncv - cv));
+
+    /* round down, writes only happen when the current crosses a step */
+
+    if (plot->current_step > 0) {
+        current -= current % plot->current_step;
     }
+    return current;
 }
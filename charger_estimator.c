@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2023 Xiaomi Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+
+#include "charger_estimator.h"
+#include <math.h>
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+
+static int charger_estimator_min(struct charger_manager* manager)
+{
+    return manager->desc.ir.resistance_max > 0 ? manager->desc.ir.resistance_min
+                                               : CHARGER_ESTIMATOR_RESISTANCE_MIN;
+}
+
+static int charger_estimator_max(struct charger_manager* manager)
+{
+    return manager->desc.ir.resistance_max > 0 ? manager->desc.ir.resistance_max
+                                               : CHARGER_ESTIMATOR_RESISTANCE_MAX;
+}
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+/****************************************************************************
+ * Name: charger_estimator_init
+ *
+ * Description:
+ *   seed the internal resistance from the configuration and forget the
+ *   last sample
+ *
+ * Input Parameters:
+ *   manager - the struct charger_manager instance
+ ****************************************************************************/
+
+void charger_estimator_init(struct charger_manager* manager)
+{
+    struct battery_estimator* estimator = &manager->estimator;
+    int resistance = manager->desc.ir.resistance;
+
+    if (resistance <= 0) {
+        resistance = CHARGER_ESTIMATOR_RESISTANCE;
+    }
+
+    memset(estimator, 0, sizeof(struct battery_estimator));
+    estimator->resistance = resistance / 1000.0f;
+    estimator->variance = CHARGER_ESTIMATOR_VARIANCE;
+    manager->snapshot.resistance = resistance;
+}
+
+/****************************************************************************
+ * Name: charger_estimator_update
+ *
+ * Description:
+ *   feed the battery snapshot of this tick. The open circuit voltage hardly
+ *   moves within a tick, so the voltage and current steps since the last
+ *   tick follow dV = R * dI, R is tracked by a scalar recursive least
+ *   squares with forgetting. Only steps around a setpoint write are fed,
+ *   the load moves the current on its own between them and its voltage
+ *   is not the cell's. Steps below CHARGER_ESTIMATOR_MIN_STEP carry
+ *   no information and a step that implies a resistance out of bounds is
+ *   taken as a load transient and dropped. The estimate is published in
+ *   the snapshot.
+ *
+ * Input Parameters:
+ *   manager - the struct charger_manager instance
+ ****************************************************************************/
+
+void charger_estimator_update(struct charger_manager* manager)
+{
+    struct battery_estimator* estimator = &manager->estimator;
+    int voltage = manager->snapshot.voltage;
+    int current = manager->snapshot.current;
+    float gain;
+    float dv;
+    float di;
+    int sample;
+
+    di = (current - estimator->current) / 1000.0f;
+    dv = (voltage - estimator->voltage) / 1000.0f;
+    if (estimator->sampled && estimator->excited
+        && abs(current - estimator->current) >= CHARGER_ESTIMATOR_MIN_STEP) {
+        sample = dv / di * 1000;
+        if (sample >= charger_estimator_min(manager) && sample <= charger_estimator_max(manager)) {
+            gain = estimator->variance * di
+                / (CHARGER_ESTIMATOR_FORGET * CHARGER_ESTIMATOR_NOISE + di * estimator->variance * di);
+            estimator->resistance += gain * (dv - estimator->resistance * di);
+            estimator->variance = (1.0f - gain * di) * estimator->variance / CHARGER_ESTIMATOR_FORGET;
+            estimator->accepted++;
+            chargerdebug("battery resistance sample %d mOhm, estimate %d mOhm\n",
+                sample, (int)(estimator->resistance * 1000));
+        } else {
+            estimator->rejected++;
+            chargerdebug("battery resistance sample %d mOhm out of bounds\n", sample);
+        }
+    }
+
+    if (estimator->resistance * 1000 < charger_estimator_min(manager)) {
+        estimator->resistance = charger_estimator_min(manager) / 1000.0f;
+    } else if (estimator->resistance * 1000 > charger_estimator_max(manager)) {
+        estimator->resistance = charger_estimator_max(manager) / 1000.0f;
+    }
+
+    estimator->voltage = voltage;
+    estimator->current = current;
+    estimator->sampled = true;
+    estimator->excited = false;
+    manager->snapshot.resistance = estimator->resistance * 1000;
+}
+
+/****************************************************************************
+ * Name: charger_estimator_ocv
+ *
+ * Description:
+ *   the battery voltage of the snapshot without the drop the charge
+ *   current causes on the internal resistance, the correction never
+ *   exceeds compensation_max
+ *
+ * Input Parameters:
+ *   manager - the struct charger_manager instance
+ *
+ * Returned Value:
+ *    the compensated voltage(mV), the measured one while disabled
+ ****************************************************************************/
+
+int charger_estimator_ocv(struct charger_manager* manager)
+{
+    struct charger_ir_parameter* ir = &manager->desc.ir;
+    int voltage = manager->snapshot.voltage;
+    int current = manager->snapshot.current;
+    int drop;
+
+    if (!ir->enable || current <= 0) {
+        return voltage;
+    }
+
+    drop = (int64_t)current * manager->snapshot.resistance / 1000;
+    if (drop > ir->compensation_max) {
+        drop = ir->compensation_max;
+    }
+    return voltage - drop;
+}
+
+/****************************************************************************
+ * Name: charger_estimator_get_stats
+ *
+ * Description:
+ *   get the internal resistance estimate and its counters
+ *
+ * Input Parameters:
+ *   manager - the struct charger_manager instance
+ *   stats - the pointer to save the estimate
+ ****************************************************************************/
+
+void charger_estimator_get_stats(struct charger_manager* manager, struct charger_estimator_stats* stats)
+{
+    stats->resistance = manager->estimator.resistance * 1000;
+    stats->deviation = sqrtf(manager->estimator.variance) * 1000;
+    stats->accepted = manager->estimator.accepted;
+    stats->rejected = manager->estimator.rejected;
+}
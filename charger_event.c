@@ -0,0 +1,395 @@
+/*
+ * Copyright (C) 2023 Xiaomi Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+
+#include "charger_event.h"
+#include "charger_statemachine.h"
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+#define CHARGER_EVENT_RING_MASK (CHARGER_EVENT_RING_SIZE - 1)
+#define CHARGER_EVENT_ORDER_KINDS (CHARGER_EVENT_POLL + 1)
+
+/****************************************************************************
+ * Private Types
+ ****************************************************************************/
+
+struct charger_event_cell {
+    atomic_uint seq;
+    charger_msg_t msg;
+};
+
+/*
+ * Bounded multi-producer single-consumer ring, a producer claims a cell by
+ * advancing head and publishes it by storing the cell sequence. When the
+ * ring is full the event kind is latched in overflow_mask instead, so an
+ * event is never lost, only merged with others of the same kind.
+ */
+
+struct charger_event_ring {
+    struct charger_event_cell cells[CHARGER_EVENT_RING_SIZE];
+    atomic_uint head;
+    unsigned int tail;
+    atomic_uint overflow_mask;
+    atomic_uint posted;
+    atomic_uint overflows;
+    unsigned int reported;
+    unsigned int coalesced;
+    uint32_t safety_latency_last_us;
+    uint32_t safety_latency_max_us;
+    int efd;
+};
+
+/****************************************************************************
+ * Private Data
+ ****************************************************************************/
+
+static struct charger_event_ring g_charger_event_ring = {
+    .efd = CHARGER_FD_INVAILD,
+};
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+
+static bool charger_event_push(struct charger_event_ring* ring, const charger_msg_t* msg)
+{
+    struct charger_event_cell* cell;
+    unsigned int pos;
+    unsigned int seq;
+    int diff;
+
+    pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    for (;;) {
+        cell = &ring->cells[pos & CHARGER_EVENT_RING_MASK];
+        seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        diff = (int)(seq - pos);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring->head, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        }
+    }
+
+    cell->msg = *msg;
+    atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+    return true;
+}
+
+static bool charger_event_pop(struct charger_event_ring* ring, charger_msg_t* msg)
+{
+    struct charger_event_cell* cell;
+    unsigned int seq;
+
+    cell = &ring->cells[ring->tail & CHARGER_EVENT_RING_MASK];
+    seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+    if ((int)(seq - (ring->tail + 1)) < 0) {
+        return false;
+    }
+
+    *msg = cell->msg;
+    atomic_store_explicit(&cell->seq, ring->tail + CHARGER_EVENT_RING_SIZE,
+        memory_order_release);
+    ring->tail++;
+    return true;
+}
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+/****************************************************************************
+ * Name: charger_event_init
+ *
+ * Description:
+ *   reset the event ring and create the eventfd used to wake the event loop
+ *
+ * Returned Value:
+ *    the eventfd on success or a negated value on failure.
+ ****************************************************************************/
+
+int charger_event_init(void)
+{
+    struct charger_event_ring* ring = &g_charger_event_ring;
+    unsigned int i;
+
+    for (i = 0; i < CHARGER_EVENT_RING_SIZE; i++) {
+        atomic_init(&ring->cells[i].seq, i);
+    }
+    atomic_init(&ring->head, 0);
+    ring->tail = 0;
+    atomic_init(&ring->overflow_mask, 0);
+    atomic_init(&ring->posted, 0);
+    atomic_init(&ring->overflows, 0);
+    ring->reported = 0;
+    ring->coalesced = 0;
+    ring->safety_latency_last_us = 0;
+    ring->safety_latency_max_us = 0;
+
+    ring->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (ring->efd < 0) {
+        chargererr("eventfd create failed: %d\n", errno);
+        return CHARGER_FAILED;
+    }
+    return ring->efd;
+}
+
+/****************************************************************************
+ * Name: charger_event_unit
+ *
+ * Description:
+ *   forget the eventfd, it is closed together with the other event handlers
+ ****************************************************************************/
+
+void charger_event_unit(void)
+{
+    g_charger_event_ring.efd = CHARGER_FD_INVAILD;
+}
+
+/****************************************************************************
+ * Name: charger_event_post
+ *
+ * Description:
+ *   queue an event for the state machine, safe to call from any thread
+ *
+ * Input Parameters:
+ *   msg - the event to queue
+ *
+ * Returned Value:
+ *    Zero on success or a negated value on failure.
+ ****************************************************************************/
+
+int charger_event_post(const charger_msg_t* msg)
+{
+    struct charger_event_ring* ring = &g_charger_event_ring;
+    charger_msg_t stamped = *msg;
+    uint64_t one = 1;
+
+    if (ring->efd < 0) {
+        chargererr("event ring is not initialized\n");
+        return CHARGER_FAILED;
+    }
+
+    stamped.post_us = charger_get_time_us();
+    if (!charger_event_push(ring, &stamped)) {
+        atomic_fetch_or_explicit(&ring->overflow_mask, 1U << msg->event,
+            memory_order_release);
+        atomic_fetch_add_explicit(&ring->overflows, 1, memory_order_relaxed);
+    }
+    atomic_fetch_add_explicit(&ring->posted, 1, memory_order_relaxed);
+
+    /* a saturated counter already guarantees a wakeup, EAGAIN is harmless */
+
+    write(ring->efd, &one, sizeof(one));
+    return CHARGER_OK;
+}
+
+/****************************************************************************
+ * Name: charger_event_ack
+ *
+ * Description:
+ *   reset the eventfd counter, the ring itself is drained by
+ *   charger_event_fetch
+ *
+ * Input Parameters:
+ *   fd - the eventfd returned by charger_event_init
+ ****************************************************************************/
+
+void charger_event_ack(int fd)
+{
+    uint64_t count;
+
+    read(fd, &count, sizeof(count));
+}
+
+/****************************************************************************
+ * Name: charger_event_fetch
+ *
+ * Description:
+ *   move all pending events into msgs, the events latched by overflow
+ *   follow the ones taken from the ring
+ *
+ * Input Parameters:
+ *   msgs - buffer for the events
+ *   max - capacity of msgs, CHARGER_EVENT_BATCH_MAX never truncates
+ *
+ * Returned Value:
+ *    the number of events stored in msgs
+ ****************************************************************************/
+
+int charger_event_fetch(charger_msg_t* msgs, int max)
+{
+    struct charger_event_ring* ring = &g_charger_event_ring;
+    unsigned int overflow_mask;
+    unsigned int overflows;
+    int num = 0;
+    int event;
+
+    while (num < max && charger_event_pop(ring, &msgs[num])) {
+        num++;
+    }
+
+    overflow_mask = atomic_exchange_explicit(&ring->overflow_mask, 0, memory_order_acquire);
+    for (event = 0; overflow_mask != 0 && num < max; event++) {
+        if (overflow_mask & (1U << event)) {
+            overflow_mask &= ~(1U << event);
+            msgs[num].event = event;
+            msgs[num].time_gap = 0;
+            msgs[num].post_us = charger_get_time_us();
+            num++;
+        }
+    }
+
+    overflows = atomic_load_explicit(&ring->overflows, memory_order_relaxed);
+    if (overflows != ring->reported) {
+        chargerwarn("event ring overflowed %u times\n", overflows);
+        ring->reported = overflows;
+    }
+    return num;
+}
+
+/****************************************************************************
+ * Name: charger_event_order
+ *
+ * Description:
+ *   coalesce a batch of events and sort it by priority in place. Plug out
+ *   and over temperature go first, then plug in and over temperature
+ *   recovery, then the periodic timeout, the algorithm poll and the
+ *   regulation tick last, so a new plot is applied before it is regulated.
+ *   Each kind is delivered at most once, a plug in (recovery) that happened
+ *   before the last plug out (over temperature) of the batch is superseded
+ *   and dropped, and so is a poll in a batch with a periodic timeout, which
+ *   polls as well.
+ *
+ * Input Parameters:
+ *   msgs - the batch returned by charger_event_fetch
+ *   num - the number of events in msgs
+ *
+ * Returned Value:
+ *    the number of events left in msgs
+ ****************************************************************************/
+
+int charger_event_order(charger_msg_t* msgs, int num)
+{
+    static const charger_event_e order[] = {
+        CHARGER_EVENT_PLUGOUT,
+        CHARGER_EVENT_OVERTEMP,
+        CHARGER_EVENT_PLUGIN,
+        CHARGER_EVENT_OVERTEMP_RECOVERY,
+        CHARGER_EVENT_CHG_TIMEOUT,
+        CHARGER_EVENT_POLL,
+        CHARGER_EVENT_REGULATE,
+    };
+    charger_msg_t first[CHARGER_EVENT_ORDER_KINDS];
+    int last[CHARGER_EVENT_ORDER_KINDS];
+    int out = 0;
+    int i;
+
+    for (i = 0; i < CHARGER_EVENT_ORDER_KINDS; i++) {
+        last[i] = -1;
+    }
+
+    /* keep the oldest stamp of each kind so the latency is not hidden */
+
+    for (i = 0; i < num; i++) {
+        if (msgs[i].event >= CHARGER_EVENT_ORDER_KINDS) {
+            continue;
+        }
+        if (last[msgs[i].event] < 0) {
+            first[msgs[i].event] = msgs[i];
+        }
+        last[msgs[i].event] = i;
+    }
+
+    if (last[CHARGER_EVENT_PLUGIN] < last[CHARGER_EVENT_PLUGOUT]) {
+        last[CHARGER_EVENT_PLUGIN] = -1;
+    }
+    if (last[CHARGER_EVENT_OVERTEMP_RECOVERY] < last[CHARGER_EVENT_OVERTEMP]) {
+        last[CHARGER_EVENT_OVERTEMP_RECOVERY] = -1;
+    }
+    if (last[CHARGER_EVENT_CHG_TIMEOUT] >= 0) {
+        last[CHARGER_EVENT_POLL] = -1;
+    }
+
+    for (i = 0; i < CHARGER_EVENT_ORDER_KINDS; i++) {
+        if (last[order[i]] >= 0) {
+            msgs[out++] = first[order[i]];
+        }
+    }
+
+    g_charger_event_ring.coalesced += num - out;
+    return out;
+}
+
+/****************************************************************************
+ * Name: charger_event_account
+ *
+ * Description:
+ *   record the latency from posting to handling of a safety event, it is
+ *   called right before the event is handed to the state machine
+ *
+ * Input Parameters:
+ *   msg - the event about to be handled
+ ****************************************************************************/
+
+void charger_event_account(const charger_msg_t* msg)
+{
+    struct charger_event_ring* ring = &g_charger_event_ring;
+    uint32_t latency;
+
+    if (msg->event != CHARGER_EVENT_PLUGOUT && msg->event != CHARGER_EVENT_OVERTEMP) {
+        return;
+    }
+
+    latency = charger_get_time_us() - msg->post_us;
+    ring->safety_latency_last_us = latency;
+    if (latency > ring->safety_latency_max_us) {
+        ring->safety_latency_max_us = latency;
+        chargerinfo("safety event %d latency max %" PRIu32 " us\n", msg->event, latency);
+    }
+}
+
+/****************************************************************************
+ * Name: charger_event_get_stats
+ *
+ * Description:
+ *   get the event counters
+ *
+ * Input Parameters:
+ *   stats - the pointer to save counters
+ ****************************************************************************/
+
+void charger_event_get_stats(struct charger_event_stats* stats)
+{
+    stats->posted = atomic_load_explicit(&g_charger_event_ring.posted, memory_order_relaxed);
+    stats->overflows = atomic_load_explicit(&g_charger_event_ring.overflows, memory_order_relaxed);
+    stats->coalesced = g_charger_event_ring.coalesced;
+    stats->safety_latency_last_us = g_charger_event_ring.safety_latency_last_us;
+    stats->safety_latency_max_us = g_charger_event_ring.safety_latency_max_us;
+}
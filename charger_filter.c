@@ -0,0 +1,185 @@
+/*
+ * Copyright (C) 2023 Xiaomi Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+
+#include "charger_filter.h"
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+
+static struct charger_filter_parameter* charger_filter_parameter(struct charger_manager* manager, int signal)
+{
+    if (signal == CHARGER_FILTER_GAUGE_TEMP) {
+        signal = CHARGER_FILTER_TEMP;
+    }
+    return &manager->desc.filter[signal];
+}
+
+static int charger_filter_median(struct signal_filter* filter)
+{
+    int sorted[MAX_FILTER_WINDOW];
+    int value;
+    int i;
+    int j;
+
+    for (i = 0; i < filter->num; i++) {
+        value = filter->window[i];
+        for (j = i; j > 0 && sorted[j - 1] > value; j--) {
+            sorted[j] = sorted[j - 1];
+        }
+        sorted[j] = value;
+    }
+    return sorted[filter->num / 2];
+}
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+/****************************************************************************
+ * Name: charger_filter_init
+ *
+ * Description:
+ *   reset the filters of all signals, the gauge temperature included
+ *
+ * Input Parameters:
+ *   manager - the struct charger_manager instance
+ ****************************************************************************/
+
+void charger_filter_init(struct charger_manager* manager)
+{
+    int signal;
+
+    for (signal = 0; signal < CHARGER_FILTER_STATES; signal++) {
+        charger_filter_reset(manager, signal);
+    }
+}
+
+/****************************************************************************
+ * Name: charger_filter_reset
+ *
+ * Description:
+ *   forget the history of a signal, the next sample passes unfiltered.
+ *   The counters are kept.
+ *
+ * Input Parameters:
+ *   manager - the struct charger_manager instance
+ *   signal - enum charger_filter_signal or CHARGER_FILTER_GAUGE_TEMP
+ ****************************************************************************/
+
+void charger_filter_reset(struct charger_manager* manager, int signal)
+{
+    struct signal_filter* filter = &manager->filter[signal];
+
+    filter->num = 0;
+    filter->pos = 0;
+    filter->primed = false;
+}
+
+/****************************************************************************
+ * Name: charger_filter_update
+ *
+ * Description:
+ *   run a sample through the median of the last samples and then the
+ *   exponential moving average configured for the signal. Each source
+ *   has its own state, CHARGER_FILTER_GAUGE_TEMP filters the gauge
+ *   temperature with the parameters of CHARGER_FILTER_TEMP.
+ *
+ * Input Parameters:
+ *   manager - the struct charger_manager instance
+ *   signal - enum charger_filter_signal or CHARGER_FILTER_GAUGE_TEMP
+ *   sample - the raw value
+ *
+ * Returned Value:
+ *    the filtered value
+ ****************************************************************************/
+
+int charger_filter_update(struct charger_manager* manager, int signal, int sample)
+{
+    struct charger_filter_parameter* parameter = charger_filter_parameter(manager, signal);
+    struct signal_filter* filter = &manager->filter[signal];
+    int value = sample;
+
+    if (parameter->median > 1) {
+        filter->window[filter->pos] = sample;
+        filter->pos = (filter->pos + 1) % parameter->median;
+        if (filter->num < parameter->median) {
+            filter->num++;
+        }
+        value = charger_filter_median(filter);
+    }
+
+    if (parameter->ema > 0 && parameter->ema < 100 && filter->primed) {
+        filter->state += (value * 256 - filter->state) * parameter->ema / 100;
+        value = filter->state >= 0 ? (filter->state + 128) / 256 : (filter->state - 128) / 256;
+    } else {
+        filter->state = value * 256;
+    }
+
+    if (filter->primed) {
+        filter->raw_changes += sample != filter->raw;
+        filter->changes += value != filter->value;
+    }
+    filter->raw = sample;
+    filter->value = value;
+    filter->primed = true;
+    filter->samples++;
+    return value;
+}
+
+/****************************************************************************
+ * Name: charger_filter_snapshot
+ *
+ * Description:
+ *   filter the voltage, current and temperature of the battery snapshot
+ *   in place
+ *
+ * Input Parameters:
+ *   manager - the struct charger_manager instance
+ ****************************************************************************/
+
+void charger_filter_snapshot(struct charger_manager* manager)
+{
+    struct battery_snapshot* snapshot = &manager->snapshot;
+
+    snapshot->voltage = charger_filter_update(manager, CHARGER_FILTER_VOLTAGE, snapshot->voltage);
+    snapshot->current = charger_filter_update(manager, CHARGER_FILTER_CURRENT, snapshot->current);
+    snapshot->temp = charger_filter_update(manager, CHARGER_FILTER_GAUGE_TEMP, snapshot->temp);
+}
+
+/****************************************************************************
+ * Name: charger_filter_get_stats
+ *
+ * Description:
+ *   get the counters of a signal
+ *
+ * Input Parameters:
+ *   manager - the struct charger_manager instance
+ *   signal - enum charger_filter_signal or CHARGER_FILTER_GAUGE_TEMP
+ *   stats - the pointer to save the counters
+ ****************************************************************************/
+
+void charger_filter_get_stats(struct charger_manager* manager, int signal, struct charger_filter_stats* stats)
+{
+    stats->samples = manager->filter[signal].samples;
+    stats->raw_changes = manager->filter[signal].raw_changes;
+    stats->changes = manager->filter[signal].changes;
+}
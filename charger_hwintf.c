@@ -21,10 +21,51 @@
 #include "charger_hwintf.h"
 #include "charger_statemachine.h"
 
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+
+static bool is_charger_sharing(struct charger_manager* manager, int seq, int index)
+{
+    struct charger_sharing_state* sharing = &manager->sharing;
+
+    if (sharing->primary == CHARGER_INDEX_INVAILD) {
+        return false;
+    }
+    return (seq == sharing->primary && index == sharing->secondary)
+        || (seq == sharing->secondary && index == sharing->primary);
+}
+
 /****************************************************************************
  * Public Functions
  ****************************************************************************/
 
+/****************************************************************************
+ * Name: invalidate_charger_shadow()
+ *
+ * Description:
+ *   forget the values remembered for the supply and the chargers, so the
+ *   next write of each register always reaches the driver
+ *
+ * Input Parameters:
+ *   manager - the struct charger_manager instance
+ *
+ * Returned Value:
+ *    None
+ ****************************************************************************/
+
+void invalidate_charger_shadow(struct charger_manager* manager)
+{
+    int i;
+
+    manager->shadow.supply_vol = CHARGER_SHADOW_INVAILD;
+    for (i = 0; i < MAX_CHARGERS; i++) {
+        manager->shadow.charger_vol[i] = CHARGER_SHADOW_INVAILD;
+        manager->shadow.charger_current[i] = CHARGER_SHADOW_INVAILD;
+        manager->shadow.charger_enable[i] = CHARGER_SHADOW_INVAILD;
+    }
+}
+
 /****************************************************************************
  * Name: enable_adapter()
  *
@@ -50,17 +91,58 @@ int enable_adapter(struct charger_manager* manager, bool enable)
     }
     msg.operate_type = (enable) ? BATIO_OPRTN_SYSON : BATIO_OPRTN_SYSOFF;
     ret = ioctl(manager->adapter_fd, BATIOC_OPERATE, (unsigned long)((uintptr_t)&msg));
+
+    /* the supply and the chargers may be reset by switching the adapter */
+
+    invalidate_charger_shadow(manager);
     if (ret < 0) {
+        manager->fault.err = errno;
         chargererr("Error: ioctl(BATIOC_OPERATE) failed: %d\n", errno);
         return CHARGER_FAILED;
     }
 
+    /*
+     * The adapter needs enable_delay_ms before it can be accessed. Rather
+     * than sleeping, remember the deadline and ask the event loop for a
+     * tick once it has passed, safety events keep being handled meanwhile.
+     */
+
+    manager->adapter_settle_us = 0;
     if (manager->desc.enable_delay_ms > 0 && enable) {
-        charger_delay(manager->desc.enable_delay_ms);
+        manager->adapter_settle_us = charger_get_time_us()
+            + (uint64_t)manager->desc.enable_delay_ms * 1000;
+        charger_timer_defer(manager->defer_fd, manager->desc.enable_delay_ms);
     }
     return CHARGER_OK;
 }
 
+/****************************************************************************
+ * Name: is_adapter_settling()
+ *
+ * Description:
+ *   check whether the adapter is still within enable_delay_ms after it
+ *   was enabled
+ *
+ * Input Parameters:
+ *   manager - the struct charger_manager instance
+ *
+ * Returned Value:
+ *    true if the adapter is not ready yet, otherwise false
+ ****************************************************************************/
+
+bool is_adapter_settling(struct charger_manager* manager)
+{
+    if (manager->adapter_settle_us == 0) {
+        return false;
+    }
+
+    if (charger_get_time_us() >= manager->adapter_settle_us) {
+        manager->adapter_settle_us = 0;
+        return false;
+    }
+    return true;
+}
+
 /****************************************************************************
  * Name: get_adapter_type()
  *
@@ -86,6 +168,7 @@ int get_adapter_type(struct charger_manager* manager, int* type)
     }
     ret = ioctl(manager->adapter_fd, BATIOC_GET_PROTOCOL, (unsigned long)((uintptr_t)&adapter));
     if (ret < 0) {
+        manager->fault.err = errno;
         chargererr("Error: ioctl(BATIOC_GET_PROTOCOL) failed: %d\n", errno);
         return CHARGER_FAILED;
     }
@@ -115,12 +198,19 @@ int set_supply_voltage(struct charger_manager* manager, int vol)
         chargererr("Error: adapter not exsit\n");
         return CHARGER_FAILED;
     }
+    if (manager->shadow.supply_vol == vol) {
+        return CHARGER_OK;
+    }
     chargerdebug("set supply voltage:%d\n", vol);
     ret = ioctl(manager->supply_fd, BATIOC_VOLTAGE, (unsigned long)((uintptr_t)&vol));
     if (ret < 0) {
+        manager->fault.err = errno;
         chargererr("Error: ioctl(BATIOC_VOLTAGE) failed: %d\n", errno);
+        manager->shadow.supply_vol = CHARGER_SHADOW_INVAILD;
         return CHARGER_FAILED;
     }
+    manager->shadow.supply_vol = vol;
+    manager->estimator.excited = true;
     return CHARGER_OK;
 }
 
@@ -144,9 +234,14 @@ int get_supply_voltage(struct charger_manager* manager, int* vol)
 
     ret = ioctl(manager->supply_fd, BATIOC_GET_VOLTAGE, (unsigned long)((uintptr_t)vol));
     if (ret < 0) {
+        manager->fault.err = errno;
         chargererr("Error: ioctl(BATIOC_VOLTAGE) failed: %d\n", errno);
+        manager->shadow.supply_vol = CHARGER_SHADOW_INVAILD;
         return CHARGER_FAILED;
     }
+
+    /* the shadow holds the last written setpoint, a read back may differ */
+
     return CHARGER_OK;
 }
 
@@ -175,9 +270,12 @@ int enable_charger(struct charger_manager* manager, int seq, bool enable)
         return CHARGER_FAILED;
     }
 
+    /* only the chargers sharing the current of a plot run together */
+
     if (enable) {
         for (index = 0; index < manager->desc.chargers; index++) {
-            if (seq != index) {
+            if (seq != index && manager->shadow.charger_enable[index] != false
+                && !is_charger_sharing(manager, seq, index)) {
                 ret = enable_charger(manager, index, false);
                 if (ret < 0) {
                     chargererr("Error: disable charger %d failed (%d)\n", index, ret);
@@ -187,14 +285,22 @@ int enable_charger(struct charger_manager* manager, int seq, bool enable)
         }
     }
 
+    if (manager->shadow.charger_enable[seq] == enable) {
+        return CHARGER_OK;
+    }
+
     msg.operate_type = BATIO_OPRTN_CHARGE;
     msg.u32 = enable ? 1 : 0;
 
     ret = ioctl(manager->charger_fd[seq], BATIOC_OPERATE, (unsigned long)((uintptr_t)&msg));
     if (ret < 0) {
+        manager->fault.err = errno;
         chargererr("Error: ioctl(BATIOC_OPERATE) failed: %d\n", errno);
+        manager->shadow.charger_enable[seq] = CHARGER_SHADOW_INVAILD;
         return CHARGER_FAILED;
     }
+    manager->shadow.charger_enable[seq] = enable;
+    manager->estimator.excited = true;
     return CHARGER_OK;
 }
 
@@ -222,11 +328,18 @@ int set_charger_voltage(struct charger_manager* manager, int seq, int vol)
         return CHARGER_FAILED;
     }
 
+    if (manager->shadow.charger_vol[seq] == vol) {
+        return CHARGER_OK;
+    }
+
     ret = ioctl(manager->charger_fd[seq], BATIOC_VOLTAGE, (unsigned long)((uintptr_t)&vol));
     if (ret < 0) {
+        manager->fault.err = errno;
         chargererr("Error: ioctl(BATIOC_VOLTAGE) failed: %d\n", errno);
+        manager->shadow.charger_vol[seq] = CHARGER_SHADOW_INVAILD;
         return CHARGER_FAILED;
     }
+    manager->shadow.charger_vol[seq] = vol;
     return CHARGER_OK;
 }
 
@@ -254,11 +367,19 @@ int set_charger_current(struct charger_manager* manager, int seq, int current)
         return CHARGER_FAILED;
     }
 
+    if (manager->shadow.charger_current[seq] == current) {
+        return CHARGER_OK;
+    }
+
     ret = ioctl(manager->charger_fd[seq], BATIOC_CURRENT, (unsigned long)((uintptr_t)&current));
     if (ret < 0) {
+        manager->fault.err = errno;
         chargererr("Error: ioctl(BATIOC_CURRENT) failed: %d\n", errno);
+        manager->shadow.charger_current[seq] = CHARGER_SHADOW_INVAILD;
         return CHARGER_FAILED;
     }
+    manager->shadow.charger_current[seq] = current;
+    manager->estimator.excited = true;
     return CHARGER_OK;
 }
 
@@ -289,6 +410,7 @@ int get_charger_state(struct charger_manager* manager, int seq, unsigned int* st
 
     ret = ioctl(manager->charger_fd[seq], BATIOC_STATE, (unsigned long)((uintptr_t)&charger_state));
     if (ret < 0) {
+        manager->fault.err = errno;
         chargererr("ERROR: ioctl(BATIOC_STATE) failed: %d\n", errno);
         return CHARGER_FAILED;
     }
@@ -297,6 +419,43 @@ int get_charger_state(struct charger_manager* manager, int seq, unsigned int* st
     return CHARGER_OK;
 }
 
+#ifdef CONFIG_CHARGERD_CHARGER_ADC
+/****************************************************************************
+ * Name: get_charger_adc
+ *
+ * Description:
+ *   get the bus and battery voltage and current measured by the charger,
+ *   they follow a setpoint much faster than the gauge current
+ *
+ * Input Parameters:
+ *   manager - the struct charger_manager instance
+ *   seq - the index of the charger
+ *   adc - the pointer to save the ADC values
+ *
+ * Returned Value:
+ *    Zero on success or a negated errno value on failure.
+ ****************************************************************************/
+
+int get_charger_adc(struct charger_manager* manager, int seq, struct charger_adc* adc)
+{
+    int ret;
+
+    if (seq >= manager->desc.chargers && manager->charger_fd[seq] < 0) {
+        chargererr("Error: charger not exsit\n");
+        return CHARGER_FAILED;
+    }
+
+    ret = ioctl(manager->charger_fd[seq], BATIOC_GET_ADC, (unsigned long)((uintptr_t)adc));
+    if (ret < 0) {
+        chargererr("ERROR: ioctl(BATIOC_GET_ADC) failed: %d\n", errno);
+        return CHARGER_FAILED;
+    }
+    chargerdebug("charger %d adc vbus:%d ibus:%d vbat:%d ibat:%d\n", seq,
+        adc->vbus, adc->ibus, adc->vbat, adc->ibat);
+    return CHARGER_OK;
+}
+#endif
+
 int get_adapter_type_by_charger(struct charger_manager* manager, int* type)
 {
     int adapter = 0;
@@ -308,6 +467,7 @@ int get_adapter_type_by_charger(struct charger_manager* manager, int* type)
     }
     ret = ioctl(manager->charger_fd[0], BATIOC_GET_PROTOCOL, (unsigned long)((uintptr_t)&adapter));
     if (ret < 0) {
+        manager->fault.err = errno;
         chargererr("Error: ioctl(BATIOC_GET_PROTOCOL) failed: %d\n", errno);
         return CHARGER_FAILED;
     }
@@ -535,6 +695,101 @@ battery_default:
     return CHARGER_OK;
 }
 
+/****************************************************************************
+ * Name: get_battery_snapshot
+ *
+ * Description:
+ *   get voltage, current, temperature and capacity of the battery in one
+ *   pass, the gauge online state is only checked once. Any value that can
+ *   not be read falls back to the battery default parameter.
+ *
+ * Input Parameters:
+ *   manager - the struct charger_manager instance
+ *   snapshot - the pointer to save battery snapshot
+ *
+ * Returned Value:
+ *    Zero on success or a negated errno value on failure.
+ ****************************************************************************/
+
+int get_battery_snapshot(struct charger_manager* manager, struct battery_snapshot* snapshot)
+{
+    int ret;
+    bool gauge_inited;
+    b16_t vol = 0;
+    b16_t current = 0;
+    b8_t temp = 0;
+    b16_t cap = 0;
+
+    if (snapshot == NULL) {
+        chargererr("Error: snapshot is invaild\n");
+        return CHARGER_FAILED;
+    }
+
+    snapshot->voltage = manager->desc.default_param.vol;
+    snapshot->current = manager->desc.default_param.current;
+    snapshot->temp = manager->desc.default_param.temp;
+    snapshot->capacity = manager->desc.default_param.capacity;
+
+    ret = ioctl(manager->gauge_fd, BATIOC_ONLINE, (unsigned long)((uintptr_t)(&gauge_inited)));
+    if (ret < 0) {
+        chargererr("Error: ioctl(BATIOC_ONLINE) failed: %d\n", errno);
+        return CHARGER_OK;
+    }
+
+    if (!gauge_inited) {
+        chargererr("gauge has not been initialized successfully\n");
+        return CHARGER_OK;
+    }
+
+    ret = ioctl(manager->gauge_fd, BATIOC_VOLTAGE, (unsigned long)((uintptr_t)(&vol)));
+    if (ret < 0) {
+        chargererr("ERROR: ioctl(BATIOC_VOLTAGE) failed: %d\n", errno);
+    } else {
+#ifdef CONFIG_CHARGERD_HWINTF_CONVERSION
+        snapshot->voltage = b16tof(vol) * 1000;
+#else
+        snapshot->voltage = vol;
+#endif
+    }
+
+    ret = ioctl(manager->gauge_fd, BATIOC_CURRENT, (unsigned long)((uintptr_t)(&current)));
+    if (ret < 0) {
+        chargererr("ERROR: ioctl(BATIOC_CURRENT) failed: %d\n", errno);
+    } else {
+#ifdef CONFIG_CHARGERD_HWINTF_CONVERSION
+        snapshot->current = b16toi(current);
+#else
+        snapshot->current = current;
+#endif
+    }
+
+    ret = ioctl(manager->gauge_fd, BATIOC_TEMPERATURE, (unsigned long)((uintptr_t)(&temp)));
+    if (ret < 0) {
+        chargererr("ERROR: ioctl(BATIOC_TEMPERATURE) failed: %d\n", errno);
+    } else {
+#ifdef CONFIG_CHARGERD_HWINTF_CONVERSION
+        snapshot->temp = b8tof(temp) * 10;
+#else
+        snapshot->temp = temp;
+#endif
+    }
+
+    ret = ioctl(manager->gauge_fd, BATIOC_CAPACITY, (unsigned long)((uintptr_t)(&cap)));
+    if (ret < 0) {
+        chargererr("ERROR: ioctl(BATIOC_CAPACITY) failed: %d\n", errno);
+    } else {
+#ifdef CONFIG_CHARGERD_HWINTF_CONVERSION
+        snapshot->capacity = b16toi(cap);
+#else
+        snapshot->capacity = cap;
+#endif
+    }
+
+    chargerdebug("snapshot vol:%d cur:%d temp:%d cap:%d\n", snapshot->voltage,
+        snapshot->current, snapshot->temp, snapshot->capacity);
+    return CHARGER_OK;
+}
+
 /****************************************************************************
  * Name: get_battery_status
  *
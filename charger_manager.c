@@ -19,8 +19,14 @@
  ****************************************************************************/
 
 #include "charger_manager.h"
+#include "charger_estimator.h"
+#include "charger_event.h"
+#include "charger_filter.h"
 #include "charger_hwintf.h"
 #include "charger_statemachine.h"
+#include "charger_thermal.h"
+#include <inttypes.h>
+#include <sys/param.h>
 
 /****************************************************************************
  * Pre-processor Definitions
@@ -28,6 +34,14 @@
 
 #define TEMP_VALUE_GAIN 10.0
 
+/* events raised while handling a batch are handled in the same wakeup */
+
+#define CHARGER_EVENT_DISPATCH_ROUNDS 4
+
+/* the estimator, thermal, filter and event statistics are logged at most this often */
+
+#define CHARGER_STATS_INTERVAL_MS 60000
+
 /****************************************************************************
  * Private Types
  ****************************************************************************/
@@ -39,12 +53,29 @@ struct event_handler {
     handle_event callback;
 };
 
+/*
+ * calls made on a filtered temperature change and those a raw change
+ * would add, an avoided vterm update saves a BATIOC_STATE read and, when
+ * the raw value would have moved the vterm range, a charger write
+ */
+
+struct charger_filter_calls {
+    unsigned int temp_checks;
+    unsigned int temp_checks_avoided;
+    unsigned int vterm_updates;
+    unsigned int vterm_updates_avoided;
+    unsigned int vterm_writes_avoided;
+};
+
 /****************************************************************************
  * Private Function Prototypes
  ****************************************************************************/
 static int healthd_events(int fd);
 static int thermal_events(int fd);
 static int state_events(int fd);
+static int timer_events(int fd);
+static int defer_events(int fd);
+static int regulate_events(int fd);
 static int charger_dev_init(void);
 static void charger_dev_unit(void);
 static int charger_event_engine_init(void);
@@ -60,16 +91,32 @@ static struct charger_manager g_charger_manager = {
     .charger_fd = { CHARGER_FD_INVAILD },
     .gauge_fd = CHARGER_FD_INVAILD,
     .temp_protect_lock = false,
-    .env_timer_id = 0,
+    .timer_fd = CHARGER_FD_INVAILD,
+    .defer_fd = CHARGER_FD_INVAILD,
+    .regulate_fd = CHARGER_FD_INVAILD,
     .online = false,
     .epollfd = CHARGER_FD_INVAILD,
     .curr_charger = CHARGER_INDEX_INVAILD,
+    .fallback = { .from = CHARGER_INDEX_INVAILD },
+    .sharing = { .primary = CHARGER_INDEX_INVAILD },
 };
 
+/* room for the periodic tick, the poll and the regulation tick after a full batch */
+
+static charger_msg_t g_charger_msgs[CHARGER_EVENT_BATCH_MAX + 3];
+static bool g_charger_tick_pending = false;
+static bool g_charger_poll_pending = false;
+static bool g_charger_regulate_pending = false;
+static uint64_t g_charger_stats_us = 0;
+static struct charger_filter_calls g_charger_filter_calls;
+
 static struct event_handler handlers[EVENT_HANDLER_MAX] = {
     { .fd = CHARGER_FD_INVAILD, .callback = healthd_events },
     { .fd = CHARGER_FD_INVAILD, .callback = thermal_events },
     { .fd = CHARGER_FD_INVAILD, .callback = state_events },
+    { .fd = CHARGER_FD_INVAILD, .callback = timer_events },
+    { .fd = CHARGER_FD_INVAILD, .callback = defer_events },
+    { .fd = CHARGER_FD_INVAILD, .callback = regulate_events },
 };
 
 /****************************************************************************
@@ -130,6 +177,29 @@ static int check_temp_event(void)
     return ret;
 }
 
+static int derating_percent(struct charger_derating_curve* curve, int temp)
+{
+    struct derating_point* lo;
+    struct derating_point* hi;
+    int i;
+
+    if (curve->num == 0) {
+        return 100;
+    }
+    if (temp <= curve->points[0].temp) {
+        return curve->points[0].percent;
+    }
+
+    for (i = 1; i < curve->num; i++) {
+        if (temp <= curve->points[i].temp) {
+            lo = &curve->points[i - 1];
+            hi = &curve->points[i];
+            return lo->percent + (hi->percent - lo->percent) * (temp - lo->temp) / (hi->temp - lo->temp);
+        }
+    }
+    return curve->points[curve->num - 1].percent;
+}
+
 static int get_val(struct range_data* range, int rise_hys, int fall_hys,
     int current_index, int threshold, int* new_index, int* val)
 {
@@ -259,11 +329,34 @@ static int termination_voltage_update(void)
     return ret;
 }
 
+static bool charger_filter_raw_changed(int signal, int sample)
+{
+    struct signal_filter* filter = &g_charger_manager.filter[signal];
+
+    /* without the filter every change of the raw value was evaluated */
+
+    return !filter->primed || filter->raw != sample;
+}
+
+static bool termination_voltage_moves(int temp)
+{
+    struct temp_vterm_plot* vterm = &g_charger_manager.desc.temp_vterm;
+    int index = vterm->vterm_index;
+    int vol;
+
+    if (get_val(vterm->ranges, vterm->rise_hys, vterm->fall_hys, vterm->vterm_index,
+            temp, &index, &vol) < 0) {
+        return false;
+    }
+    return index != vterm->vterm_index;
+}
+
 static int healthd_events(int fd)
 {
     int ret;
     int temp;
     struct battery_state battery_state_get;
+    bool changed;
     bool online;
     charger_msg_t msg;
 
@@ -280,6 +373,12 @@ static int healthd_events(int fd)
         battery_state_get.temp, battery_state_get.curr,
         battery_state_get.voltage);
 
+    g_charger_manager.telemetry.voltage = battery_state_get.voltage;
+    g_charger_manager.telemetry.current = battery_state_get.curr;
+    g_charger_manager.telemetry.capacity = battery_state_get.level;
+    g_charger_manager.telemetry.update_us = charger_get_time_us();
+    g_charger_manager.telemetry.seq++;
+
     online = battery_state_get.online;
     if (online != g_charger_manager.online) {
         msg.event = online ? CHARGER_EVENT_PLUGIN : CHARGER_EVENT_PLUGOUT;
@@ -287,13 +386,22 @@ static int healthd_events(int fd)
         chargerassert_noreturn(ret < 0, "send plug event failed\n");
         g_charger_manager.online = online;
     }
-    temp = battery_state_get.temp;
+    changed = charger_filter_raw_changed(CHARGER_FILTER_TEMP, battery_state_get.temp);
+    temp = charger_filter_update(&g_charger_manager, CHARGER_FILTER_TEMP, battery_state_get.temp);
     if (temp != g_charger_manager.battery_temp) {
         g_charger_manager.battery_temp = temp;
+        g_charger_filter_calls.temp_checks++;
         ret = check_temp_event();
         if (g_charger_manager.desc.temp_vterm.enable) {
+            g_charger_filter_calls.vterm_updates++;
             ret = termination_voltage_update();
         }
+    } else if (changed) {
+        g_charger_filter_calls.temp_checks_avoided++;
+        if (g_charger_manager.desc.temp_vterm.enable) {
+            g_charger_filter_calls.vterm_updates_avoided++;
+            g_charger_filter_calls.vterm_writes_avoided += termination_voltage_moves(battery_state_get.temp);
+        }
     }
     return ret;
 }
@@ -301,27 +409,157 @@ static int healthd_events(int fd)
 static int thermal_events(int fd)
 {
     struct device_temperature bt;
+    bool changed;
     int ret = 0;
     int temp = 0;
+    int sample;
 
     ret = orb_copy(ORB_ID(device_temperature), fd, &bt);
-    temp = bt.skin * TEMP_VALUE_GAIN;
+    sample = bt.skin * TEMP_VALUE_GAIN;
+    changed = charger_filter_raw_changed(CHARGER_FILTER_SKIN, sample);
+    temp = charger_filter_update(&g_charger_manager, CHARGER_FILTER_SKIN, sample);
     if (temp != g_charger_manager.skin_temp) {
         g_charger_manager.skin_temp = temp;
+        g_charger_filter_calls.temp_checks++;
         ret = check_temp_event();
+    } else if (changed) {
+        g_charger_filter_calls.temp_checks_avoided++;
     }
     return ret;
 }
 
-static int state_events(int fd)
+static void charger_stats_report(void)
+{
+    struct charger_estimator_stats estimator;
+    struct charger_thermal_stats thermal;
+    struct charger_filter_stats filter;
+    struct charger_event_stats event;
+    uint64_t now = charger_get_time_us();
+    int i;
+
+    if (now - g_charger_stats_us < CHARGER_STATS_INTERVAL_MS * 1000ULL) {
+        return;
+    }
+    g_charger_stats_us = now;
+
+    charger_estimator_get_stats(&g_charger_manager, &estimator);
+    chargerinfo("stats resistance:%d+-%d mOhm accepted:%u rejected:%u\n",
+        estimator.resistance, estimator.deviation, estimator.accepted, estimator.rejected);
+
+    for (i = 0; i < THERMAL_SENSOR_MAX; i++) {
+        charger_thermal_get_stats(&g_charger_manager, i, &thermal);
+        chargerinfo("stats thermal %d tau:%d s rise:%d/W forecast:%d samples:%u\n",
+            i, thermal.time_constant, thermal.rise, thermal.forecast, thermal.samples);
+    }
+
+    for (i = 0; i < CHARGER_FILTER_STATES; i++) {
+        charger_filter_get_stats(&g_charger_manager, i, &filter);
+        chargerinfo("stats filter %d passed %u of %u changes in %u samples\n",
+            i, filter.changes, filter.raw_changes, filter.samples);
+    }
+    chargerinfo("stats temp checks:%u avoided:%u vterm updates:%u avoided:%u writes avoided:%u\n",
+        g_charger_filter_calls.temp_checks, g_charger_filter_calls.temp_checks_avoided,
+        g_charger_filter_calls.vterm_updates, g_charger_filter_calls.vterm_updates_avoided,
+        g_charger_filter_calls.vterm_writes_avoided);
+
+    charger_event_get_stats(&event);
+    chargerinfo("stats events posted:%u overflows:%u coalesced:%u safety latency:%" PRIu32 "/%" PRIu32 " us\n",
+        event.posted, event.overflows, event.coalesced,
+        event.safety_latency_last_us, event.safety_latency_max_us);
+}
+
+static void charger_dispatch_msg(charger_msg_t* msg)
 {
-    charger_msg_t recive_msg;
     bool changed = false;
 
-    if (mq_receive(fd, (char*)&recive_msg, sizeof(recive_msg), NULL) > 0) {
-        do {
-            charger_statemachine_state_run(&g_charger_manager, &recive_msg, &changed);
-        } while (changed);
+    do {
+        charger_statemachine_state_run(&g_charger_manager, msg, &changed);
+    } while (changed);
+}
+
+static void charger_event_dispatch(void)
+{
+    charger_msg_t* msgs = g_charger_msgs;
+    int rounds;
+    int num;
+    int i;
+
+    for (rounds = 0; rounds < CHARGER_EVENT_DISPATCH_ROUNDS; rounds++) {
+        num = charger_event_fetch(msgs, CHARGER_EVENT_BATCH_MAX);
+        if (g_charger_tick_pending) {
+            g_charger_tick_pending = false;
+            msgs[num].event = CHARGER_EVENT_CHG_TIMEOUT;
+            msgs[num].time_gap = 0;
+            msgs[num].post_us = charger_get_time_us();
+            num++;
+        }
+        if (g_charger_poll_pending) {
+            g_charger_poll_pending = false;
+            msgs[num].event = CHARGER_EVENT_POLL;
+            msgs[num].time_gap = 0;
+            msgs[num].post_us = charger_get_time_us();
+            num++;
+        }
+        if (g_charger_regulate_pending) {
+            g_charger_regulate_pending = false;
+            msgs[num].event = CHARGER_EVENT_REGULATE;
+            msgs[num].time_gap = 0;
+            msgs[num].post_us = charger_get_time_us();
+            num++;
+        }
+        if (num == 0) {
+            break;
+        }
+
+        num = charger_event_order(msgs, num);
+        for (i = 0; i < num; i++) {
+            charger_event_account(&msgs[i]);
+            charger_dispatch_msg(&msgs[i]);
+        }
+    }
+}
+
+static int state_events(int fd)
+{
+    /* the events are handled by charger_event_dispatch after all fds */
+
+    charger_event_ack(fd);
+    return 0;
+}
+
+static int timer_events(int fd)
+{
+    uint64_t expirations = 0;
+
+    /* expirations missed while the loop was busy are handled as one tick */
+
+    if (read(fd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+        g_charger_tick_pending = true;
+        charger_stats_report();
+    }
+    return 0;
+}
+
+static int defer_events(int fd)
+{
+    uint64_t expirations = 0;
+
+    /* a deferred deadline expired, poll the algorithm waiting for it */
+
+    if (read(fd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+        g_charger_poll_pending = true;
+    }
+    return 0;
+}
+
+static int regulate_events(int fd)
+{
+    uint64_t expirations = 0;
+
+    /* the fast loop, only the active algorithm regulates on this tick */
+
+    if (read(fd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+        g_charger_regulate_pending = true;
     }
     return 0;
 }
@@ -369,20 +607,57 @@ static int register_thermal_events(void)
 
 static int register_state_events(void)
 {
-    struct mq_attr attr;
-    mqd_t recive_mq;
+    int efd;
+
+    efd = charger_event_init();
+    if (efd < 0) {
+        chargererr("charger event init failed\n");
+        return CHARGER_FAILED;
+    }
+
+    return register_event_handler(efd, &handlers[EVENT_HANDLER_STATE]);
+}
+
+static int register_timer_events(void)
+{
+    int timerfd;
 
-    attr.mq_maxmsg = MQ_MSG_LOAD_MAX;
-    attr.mq_msgsize = sizeof(charger_msg_t);
-    attr.mq_curmsgs = 0;
-    attr.mq_flags = 0;
-    recive_mq = mq_open(MQ_MSG_NAME, O_RDWR | O_CREAT | O_NONBLOCK | O_CLOEXEC, 0644, &attr);
-    if (recive_mq == (mqd_t)CHARGER_FD_INVAILD) {
-        chargererr("err open mq;\r\n");
+    timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timerfd < 0) {
+        chargererr("timerfd_create failed: %d\n", errno);
         return CHARGER_FAILED;
     }
 
-    return register_event_handler(recive_mq, &handlers[EVENT_HANDLER_STATE]);
+    g_charger_manager.timer_fd = timerfd;
+    return register_event_handler(timerfd, &handlers[EVENT_HANDLER_TIMER]);
+}
+
+static int register_defer_events(void)
+{
+    int timerfd;
+
+    timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timerfd < 0) {
+        chargererr("timerfd_create failed: %d\n", errno);
+        return CHARGER_FAILED;
+    }
+
+    g_charger_manager.defer_fd = timerfd;
+    return register_event_handler(timerfd, &handlers[EVENT_HANDLER_DEFER]);
+}
+
+static int register_regulate_events(void)
+{
+    int timerfd;
+
+    timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timerfd < 0) {
+        chargererr("timerfd_create failed: %d\n", errno);
+        return CHARGER_FAILED;
+    }
+
+    g_charger_manager.regulate_fd = timerfd;
+    return register_event_handler(timerfd, &handlers[EVENT_HANDLER_REGULATE]);
 }
 
 static int charger_event_engine_init(void)
@@ -399,6 +674,9 @@ static int charger_event_engine_init(void)
     ret = register_healthd_events();
     ret |= register_thermal_events();
     ret |= register_state_events();
+    ret |= register_timer_events();
+    ret |= register_defer_events();
+    ret |= register_regulate_events();
 
     if (ret < 0) {
         charger_event_engine_unit();
@@ -416,6 +694,10 @@ static void charger_event_engine_unit(void)
             handlers[i].fd = CHARGER_FD_INVAILD;
         }
     }
+    g_charger_manager.timer_fd = CHARGER_FD_INVAILD;
+    g_charger_manager.defer_fd = CHARGER_FD_INVAILD;
+    g_charger_manager.regulate_fd = CHARGER_FD_INVAILD;
+    charger_event_unit();
     if (g_charger_manager.epollfd != CHARGER_FD_INVAILD) {
         close(g_charger_manager.epollfd);
         g_charger_manager.epollfd = CHARGER_FD_INVAILD;
@@ -564,6 +846,11 @@ static int charger_manager_init(void)
     g_charger_manager.currstate = CHARGER_STATE_INIT;
     g_charger_manager.nextstate = CHARGER_STATE_INIT;
     init_state_func_tables(&g_charger_manager);
+    invalidate_charger_shadow(&g_charger_manager);
+    charger_cycle_init(&g_charger_manager);
+    charger_estimator_init(&g_charger_manager);
+    charger_thermal_init(&g_charger_manager);
+    charger_filter_init(&g_charger_manager);
     if (is_adapter_exist()) {
         ret = enable_adapter(&g_charger_manager, true);
         if (ret < 0) {
@@ -584,7 +871,7 @@ desc_fail:
 
 static void charger_manager_unit(void)
 {
-    if (charger_timer_stop(&g_charger_manager.env_timer_id) != 0) {
+    if (charger_timer_stop(g_charger_manager.timer_fd) != 0) {
         chargererr("timer cancel failed.\n");
     }
     charger_event_engine_unit();
@@ -616,6 +903,7 @@ static void charger_event_engine_start(void)
                 }
             }
         }
+        charger_event_dispatch();
     }
 }
 
@@ -642,60 +930,129 @@ bool is_supply_exist(void)
 struct charger_plot_parameter* check_charger_plot(int temp, int vol, int type)
 {
     static struct charger_plot_parameter* last_pa = NULL;
+    static struct charger_plot_parameter target;
     struct charger_plot_parameter* pa = NULL;
     struct charger_plot* plot = NULL;
-    int i = 0;
+    int axis = 0;
 
     chargerdebug("temp:%d vol:%d type:%d\n", temp, vol, type);
 
-    for (i = 0; i < g_charger_manager.desc.plots; i++) {
-        plot = &g_charger_manager.desc.plot[i];
-        if (plot->mask & (1 << type)) {
-            break;
-        }
-    }
-    if (i >= g_charger_manager.desc.plots) {
+    plot = charger_desc_find_plot(&g_charger_manager.desc, type);
+    if (plot == NULL) {
         chargererr("there is no plot match type %d\n", type);
         return NULL;
     }
-    for (i = 0; i < plot->parameters; i++) {
-        pa = plot->tlbs + i;
-        if (temp >= pa->temp_range_min && temp <= pa->temp_range_max
-            && vol >= pa->vol_range_min && vol <= pa->vol_range_max) {
-            if (last_pa != NULL && pa != last_pa) {
-                if (pa->temp_range_min != last_pa->temp_range_min && pa->temp_range_max != last_pa->temp_range_max) {
-                    if (pa->temp_range_min > last_pa->temp_range_min) {
-                        if (temp < pa->temp_range_min + g_charger_manager.desc.temp_rise_hys) {
-                            pa = last_pa;
-                        }
-                    } else {
-                        if (temp > pa->temp_range_max - g_charger_manager.desc.temp_fall_hys) {
-                            pa = last_pa;
-                        }
-                    }
-                } else if (pa->vol_range_min != last_pa->vol_range_min && pa->vol_range_max != last_pa->vol_range_max) {
-                    if (pa->vol_range_min > last_pa->vol_range_min) {
-                        if (vol < pa->vol_range_min + g_charger_manager.desc.vol_rise_hys) {
-                            pa = last_pa;
-                        }
-                    } else {
-                        if (vol > pa->vol_range_max - g_charger_manager.desc.vol_fall_hys) {
-                            pa = last_pa;
-                        }
-                    }
+
+    if (plot->axis == CHARGER_PLOT_AXIS_SOC) {
+        axis = g_charger_manager.snapshot.capacity;
+    } else if (plot->axis == CHARGER_PLOT_AXIS_CYCLE) {
+        axis = g_charger_manager.cycle_count;
+    }
+
+    pa = charger_desc_lookup_plot(plot, temp, vol, axis);
+    if (pa == NULL) {
+        return NULL;
+    }
+
+    if (last_pa != NULL && pa != last_pa) {
+        if (pa->temp_range_min != last_pa->temp_range_min && pa->temp_range_max != last_pa->temp_range_max) {
+            if (pa->temp_range_min > last_pa->temp_range_min) {
+                if (temp < pa->temp_range_min + g_charger_manager.desc.temp_rise_hys) {
+                    pa = last_pa;
+                }
+            } else {
+                if (temp > pa->temp_range_max - g_charger_manager.desc.temp_fall_hys) {
+                    pa = last_pa;
+                }
+            }
+        } else if (pa->vol_range_min != last_pa->vol_range_min && pa->vol_range_max != last_pa->vol_range_max) {
+            if (pa->vol_range_min > last_pa->vol_range_min) {
+                if (vol < pa->vol_range_min + g_charger_manager.desc.vol_rise_hys) {
+                    pa = last_pa;
+                }
+            } else {
+                if (vol > pa->vol_range_max - g_charger_manager.desc.vol_fall_hys) {
+                    pa = last_pa;
                 }
             }
-            last_pa = pa;
-            return pa;
         }
     }
-    return NULL;
+    last_pa = pa;
+
+    /* the hysteresis works on the rows, only the returned copy is blended */
+
+    if (plot->interpolation && pa->charger_index != CHARGER_INDEX_INVAILD) {
+        target = *pa;
+        target.work_current = charger_desc_interpolate_plot(plot, pa, temp, vol, axis);
+        return &target;
+    }
+    return pa;
+}
+
+struct charger_plot_parameter* derate_charger_plot(struct charger_plot_parameter* pa)
+{
+    struct charger_derating_parameter* derating = &g_charger_manager.desc.derating;
+    static struct charger_plot_parameter target;
+    static int last_percent = 100;
+    static bool last_forecast = false;
+    int percent = 100;
+    int current;
+    int limit;
+
+    if (pa->charger_index == CHARGER_INDEX_INVAILD) {
+        return pa;
+    }
+
+    /* the hotter of battery and skin decides, the cutoff stays in check_temp_event */
+
+    if (derating->enable) {
+        percent = MIN(derating_percent(&derating->battery, g_charger_manager.battery_temp),
+            derating_percent(&derating->skin, g_charger_manager.skin_temp));
+        percent = MAX(MIN(percent, 100), 0);
+    }
+    if (percent != last_percent) {
+        chargerinfo("thermal derating %d%% battery:%d skin:%d\n", percent,
+            g_charger_manager.battery_temp, g_charger_manager.skin_temp);
+        last_percent = percent;
+    }
+
+    /* a charger that tripped on over current runs below the plot */
+
+    if (g_charger_manager.fault.derate > 0) {
+        percent = MIN(percent, g_charger_manager.fault.derate);
+    }
+
+    /* throttle ahead of the threshold the thermal model sees coming */
+
+    current = pa->work_current * percent / 100;
+    limit = charger_thermal_limit(&g_charger_manager);
+    if ((limit < current) != last_forecast) {
+        last_forecast = limit < current;
+        if (last_forecast) {
+            chargerinfo("thermal forecast limits %d mA to %d mA\n", current, limit);
+        } else {
+            chargerinfo("thermal forecast released\n");
+        }
+    }
+    current = MIN(current, limit);
+    if (current == pa->work_current) {
+        return pa;
+    }
+
+    if (derating->current_step > 0) {
+        current -= current % derating->current_step;
+    }
+
+    target = *pa;
+    target.work_current = current;
+    return &target;
 }
 
 int update_battery_temperature(int temp)
 {
     if (temp != g_charger_manager.battery_temp) {
         g_charger_manager.battery_temp = temp;
+        g_charger_filter_calls.temp_checks++;
         return check_temp_event();
     }
     return CHARGER_OK;
@@ -703,22 +1060,7 @@ int update_battery_temperature(int temp)
 
 int send_charger_msg(charger_msg_t msg)
 {
-    mqd_t mq;
-    struct mq_attr attr;
-    int ret;
-
-    attr.mq_maxmsg = MQ_MSG_LOAD_MAX;
-    attr.mq_msgsize = sizeof(charger_msg_t);
-    attr.mq_curmsgs = 0;
-    attr.mq_flags = 0;
-    mq = mq_open(MQ_MSG_NAME, O_RDWR | O_CREAT | O_NONBLOCK | O_CLOEXEC, 0644, &attr);
-    if (mq == (mqd_t)CHARGER_FD_INVAILD) {
-        chargererr("%s:open mq failed;\r\n", __FUNCTION__);
-        return CHARGER_FAILED;
-    }
-    ret = mq_send(mq, (const char*)&msg, sizeof(msg), 1);
-    mq_close(mq);
-    return ret;
+    return charger_event_post(&msg);
 }
 
 int main(int argc, FAR char* argv[])
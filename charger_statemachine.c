@@ -19,7 +19,25 @@
  ****************************************************************************/
 
 #include "charger_statemachine.h"
+#include "charger_estimator.h"
+#include "charger_filter.h"
+#include "charger_thermal.h"
 #include "charger_hwintf.h"
+#include <sys/param.h>
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+#define CHARGER_FAULT_RETRY_MAX 3
+#define CHARGER_FAULT_DERATE_STEP 20 // %
+#define CHARGER_FAULT_DERATE_MIN 40 // %
+#define CHARGER_FAULT_BACKOFF_SHIFT_MAX 16
+
+/* the full condition has to hold this many polling intervals */
+
+#define CHARGER_FULLBATT_DEBOUNCE 4
+#define CHARGER_CYCLE_SAVE_STEP 10
 
 /****************************************************************************
  * Private Data
@@ -29,7 +47,6 @@
 PM_WAKELOCK_DECLARE_STATIC(g_pm_wakelock_chargerd, "chargerd_wakelock", PM_IDLE_DOMAIN, PM_NORMAL);
 #endif
 
-static bool delay_lock = false;
 #ifdef CONFIG_CHARGERD_PM
 static bool pm_lock = false;
 #endif
@@ -38,79 +55,162 @@ static bool pm_lock = false;
  * Private Functions
  ****************************************************************************/
 
-static int charger_timer_cb(void)
-{
-    charger_msg_t msg;
-    msg.event = CHARGER_EVENT_CHG_TIMEOUT;
-    if (!delay_lock) {
-        send_charger_msg(msg);
-    }
-    return 0;
-}
-
 static bool check_battery_full(struct charger_manager* manager)
 {
-    int capacity;
-    int current;
-    int ret = 0;
-    static int cnt = 0;
-
-    ret = get_battery_capacity(manager, &capacity);
-    ret |= get_battery_current(manager, &current);
-    if (ret < 0) {
-        chargererr("can not get battery info , so cutoff\n");
-        return true;
-    }
+    int capacity = manager->snapshot.capacity;
+    int current = manager->snapshot.current;
+    uint64_t now;
 
     chargerdebug("capacity :%d current:%d\n", capacity, current);
     if (capacity >= manager->desc.fullbatt_capacity && current >= 0 && current <= manager->desc.fullbatt_current) {
 
-        /*three times of continuous,the condition is satisfying, avoid jitter */
+        /* the condition has to hold for a while, avoid jitter */
 
-        if (cnt++ > 3) {
+        now = charger_get_time_us();
+        if (manager->fullbatt_detect_us == 0) {
+            manager->fullbatt_detect_us = now;
+        }
+        if (now - manager->fullbatt_detect_us
+            >= CHARGER_FULLBATT_DEBOUNCE * manager->desc.polling_interval_ms * 1000ULL) {
             chargerdebug("battery is full\n");
             return true;
         }
         return false;
     }
-    cnt = 0;
+    manager->fullbatt_detect_us = 0;
     return false;
 }
 
-static void clear_fullbatt_timer_cnt(struct charger_manager* manager)
+static bool is_telemetry_fresh(struct charger_manager* manager)
 {
-    manager->fullbatt_timer_cnt = 0;
+    struct battery_telemetry* telemetry = &manager->telemetry;
+
+    if (manager->desc.telemetry_stale_ms == 0 || telemetry->seq == 0) {
+        return false;
+    }
+    return charger_get_time_us() - telemetry->update_us <= manager->desc.telemetry_stale_ms * 1000ULL;
+}
+
+/*
+ * take the battery snapshot from the battery_state stream while it is
+ * fresh and from the gauge otherwise, every decision on the snapshot sees
+ * the filtered values
+ */
+
+static int update_battery_snapshot(struct charger_manager* manager)
+{
+    struct battery_telemetry* telemetry = &manager->telemetry;
+
+    if (is_telemetry_fresh(manager)) {
+        telemetry->hits++;
+
+        /* a sample is filtered once, the temperature was in healthd_events */
+
+        if (telemetry->consumed != telemetry->seq) {
+            telemetry->consumed = telemetry->seq;
+            manager->snapshot.voltage = charger_filter_update(manager, CHARGER_FILTER_VOLTAGE, telemetry->voltage);
+            manager->snapshot.current = charger_filter_update(manager, CHARGER_FILTER_CURRENT, telemetry->current);
+            manager->snapshot.capacity = telemetry->capacity;
+        }
+        manager->snapshot.temp = manager->battery_temp;
+        return CHARGER_OK;
+    }
+
+    telemetry->misses++;
+    if (manager->desc.telemetry_stale_ms > 0) {
+        chargerdebug("battery telemetry stale, %u of %u snapshots from it\n",
+            telemetry->hits, telemetry->hits + telemetry->misses);
+    }
+
+    if (get_battery_snapshot(manager, &manager->snapshot) < 0) {
+        return CHARGER_FAILED;
+    }
+
+    charger_filter_snapshot(manager);
+    return CHARGER_OK;
+}
+
+/* only the faults seen since the tick began are classified */
+
+static void charger_fault_clear(struct charger_manager* manager)
+{
+    manager->fault.state = 0;
+    manager->fault.err = 0;
+}
+
+/* the durations are measured in elapsed time, ticks come at any rate */
+
+static void clear_fullbatt_timer(struct charger_manager* manager)
+{
+    manager->fullbatt_start_us = charger_get_time_us();
 }
 
 static bool update_fullbatt_timer(struct charger_manager* manager)
 {
     uint64_t duration;
 
-    manager->fullbatt_timer_cnt++;
-    duration = manager->fullbatt_timer_cnt * manager->desc.polling_interval_ms;
+    duration = (charger_get_time_us() - manager->fullbatt_start_us) / 1000;
     if (duration >= manager->desc.fullbatt_duration_ms) {
         return true;
     }
     return false;
 }
 
-static void clear_fault_timer_cnt(struct charger_manager* manager)
+static void clear_fault_timer(struct charger_manager* manager)
 {
-    manager->fault_timer_cnt = 0;
+    manager->fault_start_us = charger_get_time_us();
 }
 
 static bool update_fault_timer(struct charger_manager* manager)
 {
     uint64_t duration;
 
-    manager->fault_timer_cnt++;
-    duration = manager->fault_timer_cnt * manager->desc.polling_interval_ms;
-    if (duration >= manager->desc.fault_duration_ms) {
+    duration = (charger_get_time_us() - manager->fault_start_us) / 1000;
+    if (duration >= manager->fault.duration_ms) {
         return true;
     }
     return false;
 }
 
+static void save_charger_cycle(struct charger_manager* manager)
+{
+    FILE* file;
+
+    if (CONFIG_CHARGERD_CYCLE_FILE_PATH[0] == '\0') {
+        return;
+    }
+
+    file = fopen(CONFIG_CHARGERD_CYCLE_FILE_PATH, "w");
+    if (file == NULL) {
+        chargererr("Failed to open file %s\n", CONFIG_CHARGERD_CYCLE_FILE_PATH);
+        return;
+    }
+    fprintf(file, "%d %d\n", manager->cycle_count, manager->cycle_charged);
+    fclose(file);
+    manager->cycle_unsaved = 0;
+}
+
+static void update_charger_cycle(struct charger_manager* manager)
+{
+    int capacity = manager->snapshot.capacity;
+
+    /* every 100% charged in total is one equivalent full cycle */
+
+    if (manager->cycle_capacity >= 0 && capacity > manager->cycle_capacity) {
+        manager->cycle_charged += capacity - manager->cycle_capacity;
+        manager->cycle_unsaved += capacity - manager->cycle_capacity;
+        if (manager->cycle_charged >= 100) {
+            manager->cycle_charged -= 100;
+            manager->cycle_count++;
+            chargerinfo("battery cycle count %d\n", manager->cycle_count);
+            save_charger_cycle(manager);
+        } else if (manager->cycle_unsaved >= CHARGER_CYCLE_SAVE_STEP) {
+            save_charger_cycle(manager);
+        }
+    }
+    manager->cycle_capacity = capacity;
+}
+
 static int update_charger_protocol(struct charger_manager* manager)
 {
     int adapter_t = 0;
@@ -135,7 +235,14 @@ static int charger_state_init(struct charger_manager* data, charger_msg_t* peven
     int ret;
 
     if (NULL == pevent) {
-        charger_timer_stop(&data->env_timer_id);
+        charger_timer_stop(data->timer_fd);
+        invalidate_charger_shadow(data);
+
+        /* keep what was charged since the last save across the plug-out */
+
+        if (data->cycle_unsaved > 0) {
+            save_charger_cycle(data);
+        }
         set_battery_vbus_state(data, false);
 #ifdef CONFIG_CHARGERD_SYNC_CHARGE_STATE
         set_battery_charge_state(data, BATTERY_DISCHARGING);
@@ -146,13 +253,35 @@ static int charger_state_init(struct charger_manager* data, charger_msg_t* peven
 
     switch (pevent->event) {
     case CHARGER_EVENT_PLUGIN:
-        if (charger_timer_start(&data->env_timer_id, data->desc.polling_interval_ms) < 0) {
+        if (charger_timer_start(data->timer_fd, data->desc.polling_interval_ms) < 0) {
             chargererr("creat timer failed;\n");
             return CHARGER_FAILED;
         }
+        invalidate_charger_shadow(data);
+        memset(&data->aicl, 0, sizeof(struct input_current_limit));
+        memset(&data->fault, 0, sizeof(struct charger_fault));
+        data->fault.derate = 100;
+        data->fault.duration_ms = data->desc.fault_duration_ms;
+        data->fallback.from = CHARGER_INDEX_INVAILD;
+        data->sharing.primary = CHARGER_INDEX_INVAILD;
+        data->sharing.failed = false;
+        data->cycle_capacity = -1;
+        data->fullbatt_detect_us = 0;
+        data->estimator.sampled = false;
+        for (int i = 0; i < THERMAL_SENSOR_MAX; i++) {
+            data->thermal[i].sampled = false;
+        }
+        charger_filter_reset(data, CHARGER_FILTER_VOLTAGE);
+        charger_filter_reset(data, CHARGER_FILTER_CURRENT);
         set_battery_vbus_state(data, true);
         charger_wakup();
-        ret = update_charger_protocol(data);
+
+        /* a settling adapter is read by charger_chg_proc once it has settled */
+
+        ret = CHARGER_OK;
+        if (!is_adapter_settling(data)) {
+            ret = update_charger_protocol(data);
+        }
         if (data->temp_protect_lock) {
             data->nextstate = CHARGER_STATE_TEMP_PROTECT;
         } else if (ret < 0) {
@@ -200,7 +329,7 @@ static int charger_state_temp_protect(struct charger_manager* data, charger_msg_
     case CHARGER_EVENT_CHG_TIMEOUT:
         ret = get_battery_temp(data, &temp);
         chargerassert_return(ret < 0, "get battery temp failed\n");
-        ret = update_battery_temperature(temp);
+        ret = update_battery_temperature(charger_filter_update(data, CHARGER_FILTER_GAUGE_TEMP, temp));
         chargerassert_return(ret < 0, "update battery temperature failed\n");
         break;
     case CHARGER_EVENT_PLUGOUT:
@@ -213,56 +342,434 @@ static int charger_state_temp_protect(struct charger_manager* data, charger_msg_
     return CHARGER_OK;
 }
 
+static void charger_share_stop(struct charger_manager* data)
+{
+    struct charger_sharing_state* sharing = &data->sharing;
+    struct charger_algo* algo;
+    int ret;
+
+    if (sharing->primary == CHARGER_INDEX_INVAILD) {
+        return;
+    }
+
+    algo = &data->algos[sharing->secondary];
+    ret = algo->ops->stop(algo);
+    chargerassert_noreturn(ret < 0, "algo %d stop failed\n", algo->index);
+    algo->start_pending = false;
+    algo->shared = false;
+    sharing->primary = CHARGER_INDEX_INVAILD;
+}
+
 static void charger_chg_proc_algostop(struct charger_manager* data)
 {
     int curr_charger;
     struct charger_algo* algo = NULL;
     int ret;
 
+    charger_share_stop(data);
     curr_charger = data->curr_charger;
     if (curr_charger != CHARGER_INDEX_INVAILD) {
         algo = &data->algos[curr_charger];
         ret = algo->ops->stop(algo);
         chargerassert_noreturn(ret < 0, "algo %d stop failed\n", algo->index);
+        algo->start_pending = false;
         data->curr_charger = CHARGER_INDEX_INVAILD;
     }
     return;
 }
 
+static int charger_chg_proc_algostart(struct charger_algo* algo)
+{
+    int ret;
+
+    ret = algo->ops->start(algo);
+    chargerassert_return(ret < 0, "algo %d start failed\n", algo->index);
+    algo->start_pending = (ret == CHARGER_PENDING);
+    return CHARGER_OK;
+}
+
+static int charger_chg_proc_algorun(struct charger_algo* algo, struct charger_plot_parameter* pa)
+{
+    struct charger_manager* data = algo->cm;
+    int ret;
+
+    if (algo->start_pending) {
+        ret = algo->ops->poll(algo);
+        chargerassert_return(ret < 0, "algo %d start failed\n", algo->index);
+        if (ret == CHARGER_PENDING) {
+            return CHARGER_OK;
+        }
+        algo->start_pending = false;
+    }
+
+    ret = algo->ops->update(algo, pa);
+    chargerassert_return(ret < 0, "algo %d update failed\n", algo->index);
+
+    if (ret != CHARGER_PENDING && data->desc.regulate_interval_ms == 0 && algo->ops->regulate) {
+        ret = algo->ops->regulate(algo);
+        chargerassert_return(ret < 0, "algo %d regulate failed\n", algo->index);
+    }
+
+    /* the algo restarted itself, it is polled until it runs again */
+
+    if (ret == CHARGER_PENDING) {
+        charger_share_stop(data);
+        algo->start_pending = true;
+    }
+    return CHARGER_OK;
+}
+
+/* the part of the row current the sharing charger takes at this skin temperature */
+
+static int charger_share_current(struct charger_manager* data, struct charger_plot* plot,
+    struct charger_sharing* share, int current)
+{
+    int percent = share->percent;
+    int temp = data->skin_temp;
+
+    if (temp >= share->temp_max) {
+        return 0;
+    }
+    if (temp > share->temp_start) {
+        percent = percent * (share->temp_max - temp) / (share->temp_max - share->temp_start);
+    }
+
+    current = current * percent / 100;
+    if (plot->current_step > 0) {
+        current -= current % plot->current_step;
+    }
+    return current;
+}
+
+/* the current the sharing charger of the row takes, 0 without one */
+
+static int charger_share_plan(struct charger_manager* data, struct charger_plot_parameter* pa,
+    struct charger_sharing** share)
+{
+    struct charger_plot* plot;
+
+    *share = NULL;
+    plot = charger_desc_find_plot(&data->desc, data->protocol);
+    if (plot == NULL || data->sharing.failed) {
+        return 0;
+    }
+
+    *share = &plot->sharing[pa->charger_index];
+    if ((*share)->charger_index == CHARGER_INDEX_INVAILD) {
+        return 0;
+    }
+    return charger_share_current(data, plot, *share, pa->work_current);
+}
+
+/* a plot charger that does not regulate the sum leaves the shared part */
+
+static struct charger_plot_parameter* charger_share_primary(struct charger_manager* data,
+    struct charger_plot_parameter* pa, int current)
+{
+    struct charger_sharing_state* sharing = &data->sharing;
+
+    if (current <= 0 || data->algos[pa->charger_index].ops->battery_feedback) {
+        return pa;
+    }
+
+    sharing->primary_pa = *pa;
+    sharing->primary_pa.work_current = pa->work_current - current;
+    return &sharing->primary_pa;
+}
+
+static void charger_share_run(struct charger_manager* data, struct charger_plot_parameter* pa,
+    struct charger_sharing* share, int current)
+{
+    struct charger_sharing_state* sharing = &data->sharing;
+    struct charger_algo* algo;
+
+    if (current <= 0) {
+        charger_share_stop(data);
+        return;
+    }
+
+    algo = &data->algos[share->charger_index];
+    if (sharing->primary != CHARGER_INDEX_INVAILD && sharing->secondary != share->charger_index) {
+        charger_share_stop(data);
+    }
+
+    /* the sharing charger runs a copy of the row, the supply is left to the plot charger */
+
+    if (sharing->primary == CHARGER_INDEX_INVAILD) {
+        sharing->primary = pa->charger_index;
+        sharing->secondary = share->charger_index;
+        algo->shared = true;
+        if (charger_chg_proc_algostart(algo) < 0) {
+            goto fail;
+        }
+    }
+
+    sharing->pa = *pa;
+    sharing->pa.charger_index = share->charger_index;
+    sharing->pa.work_current = current;
+    sharing->pa.supply_vol = 0;
+    if (charger_chg_proc_algorun(algo, &sharing->pa) < 0) {
+        goto fail;
+    }
+    return;
+
+fail:
+
+    /* the plot charger keeps charging alone for the rest of the plug session */
+
+    chargerwarn("charger %d failed to share charger %d\n", share->charger_index, pa->charger_index);
+    charger_share_stop(data);
+    charger_fault_clear(data);
+    sharing->failed = true;
+}
+
+static int charger_regulate(struct charger_manager* data)
+{
+    struct charger_algo* algo = NULL;
+    int ret;
+
+    if (data->curr_charger == CHARGER_INDEX_INVAILD || is_adapter_settling(data)) {
+        return CHARGER_OK;
+    }
+
+    algo = &data->algos[data->curr_charger];
+    if (algo->start_pending || algo->ops->regulate == NULL) {
+        return CHARGER_OK;
+    }
+
+    charger_fault_clear(data);
+
+    /* only the current is refreshed, the rest of the snapshot is slow */
+
+    ret = get_battery_current(data, &data->snapshot.current);
+    chargerassert_return(ret < 0, "get battery current failed\n");
+    data->snapshot.current = charger_filter_update(data, CHARGER_FILTER_CURRENT, data->snapshot.current);
+    ret = algo->ops->regulate(algo);
+    chargerassert_return(ret < 0, "algo %d regulate failed\n", algo->index);
+    if (ret == CHARGER_PENDING) {
+        charger_share_stop(data);
+        algo->start_pending = true;
+        return CHARGER_OK;
+    }
+
+    if (data->sharing.primary == CHARGER_INDEX_INVAILD) {
+        return CHARGER_OK;
+    }
+
+    algo = &data->algos[data->sharing.secondary];
+    if (algo->start_pending || algo->ops->regulate == NULL) {
+        return CHARGER_OK;
+    }
+
+    if (algo->ops->regulate(algo) < 0) {
+        chargerwarn("charger %d failed to share charger %d\n", algo->index, data->sharing.primary);
+        charger_share_stop(data);
+        charger_fault_clear(data);
+        data->sharing.failed = true;
+    }
+    return CHARGER_OK;
+}
+
+static charger_fault_e charger_fault_classify(struct charger_manager* data)
+{
+    unsigned int state = data->fault.state;
+
+    if (state & VBAT_OVP_MASK) {
+        return CHARGER_FAULT_STOP;
+    }
+    if (state & (IBAT_OCP_MASK | IBUS_OCP_MASK)) {
+        return CHARGER_FAULT_DERATE;
+    }
+    if (state & (VBUS_OVP_MASK | VBUS_ERRORLO_STAT_MASK | VBUS_ERRORHI_STAT_MASK | IBUS_UCP_MASK)) {
+        return CHARGER_FAULT_FALLBACK;
+    }
+
+    /*
+     * Without a fault bit an algorithm gave up on its own, e.g. the pump
+     * found no start voltage. A bus glitch fails one access, a missing or
+     * unsupported device fails every one.
+     */
+
+    switch (data->fault.err) {
+    case 0:
+        return CHARGER_FAULT_FALLBACK;
+    case EAGAIN:
+    case EBUSY:
+    case EINTR:
+    case EIO:
+    case ETIMEDOUT:
+        return CHARGER_FAULT_RETRY;
+    default:
+        return CHARGER_FAULT_STOP;
+    }
+}
+
+static bool charger_chg_proc_fallback(struct charger_manager* data)
+{
+    struct charger_fallback_state* state = &data->fallback;
+    struct charger_fallback* fallback;
+    struct charger_plot* plot;
+    int index = data->curr_charger;
+
+    /* the chain goes on from the charger that just failed */
+
+    plot = charger_desc_find_plot(&data->desc, data->protocol);
+    if (plot == NULL || index == CHARGER_INDEX_INVAILD) {
+        return false;
+    }
+
+    fallback = &plot->fallback[index];
+    if (fallback->charger_index == CHARGER_INDEX_INVAILD || fallback->charger_index == state->from) {
+        return false;
+    }
+
+    if (state->from == CHARGER_INDEX_INVAILD) {
+        state->from = index;
+        state->retry_us = charger_get_time_us() + plot->fallback_retry_ms * 1000ULL;
+    }
+    state->to = fallback->charger_index;
+    state->work_current = fallback->work_current;
+    state->supply_vol = fallback->supply_vol;
+    chargerwarn("charger %d falls back to charger %d at %d mA for %u ms\n", index,
+        state->to, state->work_current, plot->fallback_retry_ms);
+    return true;
+}
+
+static struct charger_plot_parameter* charger_fallback_plot(struct charger_manager* data,
+    struct charger_plot_parameter* pa)
+{
+    struct charger_fallback_state* state = &data->fallback;
+
+    if (state->from == CHARGER_INDEX_INVAILD) {
+        return pa;
+    }
+
+    /* a plot row of another charger or the retry time ends the fallback */
+
+    if (pa->charger_index != state->from) {
+        state->from = CHARGER_INDEX_INVAILD;
+        return pa;
+    }
+    if (charger_get_time_us() >= state->retry_us) {
+        chargerinfo("retry charger %d after falling back to charger %d\n", state->from, state->to);
+        state->from = CHARGER_INDEX_INVAILD;
+        return pa;
+    }
+
+    state->pa = *pa;
+    state->pa.charger_index = state->to;
+    state->pa.work_current = MIN(pa->work_current, state->work_current);
+    state->pa.supply_vol = state->supply_vol;
+    return &state->pa;
+}
+
 static int charger_chg_proc_fault(struct charger_manager* data)
 {
+    struct charger_fault* fault = &data->fault;
+    charger_fault_e type;
+    uint64_t backoff;
+    uint64_t now;
+
+    /*
+     * Faults escalate until charging has run without one for a while. The
+     * time since the last fault includes the backoff, it forgives nothing.
+     */
+
+    now = charger_get_time_us();
+    if (fault->resume_us > fault->fault_us
+        && now - fault->resume_us >= data->desc.fault_duration_ms * 1000ULL) {
+        fault->retries = 0;
+        fault->stops = 0;
+    }
+    fault->fault_us = now;
+
+    type = charger_fault_classify(data);
+    if (type == CHARGER_FAULT_RETRY && fault->retries++ >= CHARGER_FAULT_RETRY_MAX) {
+        type = CHARGER_FAULT_FALLBACK;
+    } else if (type == CHARGER_FAULT_DERATE && fault->derate <= CHARGER_FAULT_DERATE_MIN) {
+        type = CHARGER_FAULT_FALLBACK;
+    }
+    chargerwarn("charger fault %d, state 0x%X errno %d\n", type, fault->state, fault->err);
+    fault->type = type;
+
+    /* the fallback charger of the plot keeps charging in the charging state */
+
+    if (type == CHARGER_FAULT_FALLBACK && charger_chg_proc_fallback(data)) {
+        type = CHARGER_FAULT_RETRY;
+    }
+
     charger_chg_proc_algostop(data);
+    invalidate_charger_shadow(data);
+
+    /* retry and derate restart the algorithm on the next tick, right away */
+
+    switch (type) {
+    case CHARGER_FAULT_DERATE:
+        fault->derate -= CHARGER_FAULT_DERATE_STEP;
+        chargerwarn("charging current derated to %d%%\n", fault->derate);
+        charger_timer_defer(data->defer_fd, 0);
+        return CHARGER_FAILED;
+    case CHARGER_FAULT_RETRY:
+        charger_timer_defer(data->defer_fd, 0);
+        return CHARGER_FAILED;
+    case CHARGER_FAULT_STOP:
+        fault->duration_ms = data->desc.fault_duration_ms;
+        if (data->desc.fault_backoff_ms > 0) {
+            backoff = (uint64_t)data->desc.fault_backoff_ms << MIN(fault->stops, CHARGER_FAULT_BACKOFF_SHIFT_MAX);
+            fault->duration_ms = MIN(backoff, data->desc.fault_duration_ms);
+            fault->stops++;
+        }
+        break;
+    default:
+        fault->duration_ms = data->desc.fault_duration_ms;
+        break;
+    }
+
     data->nextstate = CHARGER_STATE_FAULT;
     return CHARGER_FAILED;
 }
 
 static int charger_chg_proc_plot(struct charger_manager* data, struct charger_plot_parameter* pa)
 {
+    struct charger_plot_parameter* run;
+    struct charger_sharing* share;
     int* curr_charger;
     struct charger_algo* algo = NULL;
+    int current;
     int ret;
 
+    pa = charger_fallback_plot(data, pa);
+    current = charger_share_plan(data, pa, &share);
+    run = charger_share_primary(data, pa, current);
     curr_charger = &data->curr_charger;
     if (*curr_charger == CHARGER_INDEX_INVAILD) {
         *curr_charger = pa->charger_index;
         algo = &data->algos[*curr_charger];
-        ret = algo->ops->start(algo);
-        chargerassert_return(ret < 0, "algo %d start failed\n", algo->index);
+        return charger_chg_proc_algostart(algo);
     } else if (*curr_charger == pa->charger_index) {
         algo = &data->algos[*curr_charger];
-        ret = algo->ops->update(algo, pa);
-        chargerassert_return(ret < 0, "algo %d update failed\n", algo->index);
+        ret = charger_chg_proc_algorun(algo, run);
     } else {
+        charger_share_stop(data);
         algo = &data->algos[*curr_charger];
         ret = algo->ops->stop(algo);
+        algo->start_pending = false;
         chargerassert_return(ret < 0, "algo %d stop failed\n", algo->index);
         *curr_charger = pa->charger_index;
         algo = &data->algos[*curr_charger];
-        ret = algo->ops->start(algo);
-        chargerassert_return(ret < 0, "algo %d start failed\n", algo->index);
-        ret = algo->ops->update(algo, pa);
-        chargerassert_return(ret < 0, "algo %d update failed\n", algo->index);
+        ret = charger_chg_proc_algostart(algo);
+        if (ret < 0 || algo->start_pending) {
+            return ret;
+        }
+        ret = charger_chg_proc_algorun(algo, run);
+    }
+
+    /* a second charger joins once the plot charger has started */
+
+    if (ret < 0 || algo->start_pending) {
+        return ret;
     }
+    charger_share_run(data, pa, share, current);
     return CHARGER_OK;
 }
 
@@ -272,6 +779,22 @@ static int charger_chg_proc(struct charger_manager* data)
     int vol = 0;
     struct charger_plot_parameter* pa = NULL;
 
+    if (is_adapter_settling(data)) {
+        chargerdebug("adapter is settling, skip charging process\n");
+        return CHARGER_OK;
+    }
+
+    charger_fault_clear(data);
+
+    if (update_battery_snapshot(data) < 0) {
+        chargererr("can not get battery info , so cutoff\n");
+        charger_chg_proc_algostop(data);
+        data->nextstate = CHARGER_STATE_FULL;
+        return CHARGER_OK;
+    }
+
+    update_charger_cycle(data);
+    charger_estimator_update(data);
     if (check_battery_full(data)) {
         charger_chg_proc_algostop(data);
         data->nextstate = CHARGER_STATE_FULL;
@@ -283,20 +806,16 @@ static int charger_chg_proc(struct charger_manager* data)
         goto fault;
     }
 
-    if (get_battery_temp(data, &temp) < 0) {
-        chargererr("get battery temperature failed\n");
-        goto fault;
-    }
-
+    temp = data->snapshot.temp;
     if (update_battery_temperature(temp) < 0) {
         chargererr("update battery temperature failed\n");
         goto fault;
     }
+    charger_thermal_update(data);
 
-    if (get_battery_voltage(data, &vol) < 0) {
-        chargererr("get battery voltage failed\n");
-        goto fault;
-    }
+    /* select the plot on the open circuit voltage, not the charging one */
+
+    vol = charger_estimator_ocv(data);
 
     pa = check_charger_plot(temp, vol, data->protocol);
     if (NULL == pa) {
@@ -307,17 +826,51 @@ static int charger_chg_proc(struct charger_manager* data)
         chargerwarn("charger_index is invaild\n");
         charger_chg_proc_algostop(data);
         return CHARGER_OK;
+    } else {
+        pa = derate_charger_plot(pa);
     }
 
     if (charger_chg_proc_plot(data, pa) < 0) {
         chargererr("charger chg proc plot failed\n");
         goto fault;
     }
+
+    if (data->fault.resume_us <= data->fault.fault_us && data->curr_charger != CHARGER_INDEX_INVAILD
+        && !data->algos[data->curr_charger].start_pending) {
+        data->fault.resume_us = charger_get_time_us();
+    }
     return CHARGER_OK;
 fault:
     return charger_chg_proc_fault(data);
 }
 
+static int charger_chg_poll(struct charger_manager* data)
+{
+    struct charger_algo* algo = NULL;
+    int ret;
+
+    /* without a start in progress the deadline asked for the periodic work */
+
+    if (data->curr_charger == CHARGER_INDEX_INVAILD || !data->algos[data->curr_charger].start_pending) {
+        return charger_chg_proc(data);
+    }
+
+    algo = &data->algos[data->curr_charger];
+    charger_fault_clear(data);
+    ret = algo->ops->poll(algo);
+    if (ret < 0) {
+        chargererr("algo %d start failed\n", algo->index);
+        return charger_chg_proc_fault(data);
+    } else if (ret == CHARGER_PENDING) {
+        return CHARGER_OK;
+    }
+
+    /* the start finished, apply the plot instead of waiting for the tick */
+
+    algo->start_pending = false;
+    return charger_chg_proc(data);
+}
+
 static int charger_state_chg(struct charger_manager* data, charger_msg_t* pevent)
 {
     if (NULL == pevent) {
@@ -331,6 +884,13 @@ static int charger_state_chg(struct charger_manager* data, charger_msg_t* pevent
         break;
     case CHARGER_EVENT_CHG_TIMEOUT:
         return charger_chg_proc(data);
+    case CHARGER_EVENT_POLL:
+        return charger_chg_poll(data);
+    case CHARGER_EVENT_REGULATE:
+        if (charger_regulate(data) < 0) {
+            return charger_chg_proc_fault(data);
+        }
+        break;
     case CHARGER_EVENT_OVERTEMP:
         charger_chg_proc_algostop(data);
         data->nextstate = CHARGER_STATE_TEMP_PROTECT;
@@ -350,7 +910,7 @@ static int charger_state_full(struct charger_manager* data, charger_msg_t* peven
             ret = enable_adapter(data, false);
             chargerassert_noreturn(ret < 0, "disable adapter failed\n");
         }
-        clear_fullbatt_timer_cnt(data);
+        clear_fullbatt_timer(data);
         return CHARGER_OK;
     }
 
@@ -393,20 +953,24 @@ static int check_fault_plot(struct charger_manager* data)
     struct charger_plot_parameter* pa = NULL;
     struct charger_algo* algo = NULL;
 
-    if (data->desc.fault.charger_index == CHARGER_INDEX_INVAILD) {
+    if (data->desc.fault.charger_index == CHARGER_INDEX_INVAILD
+        || is_adapter_settling(data)) {
         return CHARGER_FAILED;
     }
 
-    ret = get_battery_temp(data, &temp);
-    ret |= get_battery_voltage(data, &vol);
+    ret = update_battery_snapshot(data);
     chargerassert_return(ret < 0, "get battery info failed\n");
+    temp = data->snapshot.temp;
+    vol = data->snapshot.voltage;
     pa = &data->desc.fault;
     if (temp >= pa->temp_range_min && temp <= pa->temp_range_max
         && vol >= pa->vol_range_min && vol <= pa->vol_range_max) {
         algo = &data->algos[data->desc.fault.charger_index];
         data->curr_charger = data->desc.fault.charger_index;
-        ret = algo->ops->start(algo);
-        ret |= algo->ops->update(algo, &data->desc.fault);
+        ret = charger_chg_proc_algostart(algo);
+        if (ret == CHARGER_OK && !algo->start_pending) {
+            ret = charger_chg_proc_algorun(algo, &data->desc.fault);
+        }
         if (ret < 0) {
             charger_chg_proc_algostop(data);
         }
@@ -420,7 +984,9 @@ static int charger_fault_proc(struct charger_manager* data)
     int seq = 0;
     int ret;
 
-    if (check_fault_plot(data) < 0) {
+    /* a stop keeps every charger off, the fault plot included */
+
+    if (data->fault.type == CHARGER_FAULT_STOP || check_fault_plot(data) < 0) {
         for (seq = 0; seq < data->desc.chargers; seq++) {
             ret = enable_charger(data, seq, false);
             chargerassert_noreturn(ret < 0, "disable charger %d failed\n", seq);
@@ -433,6 +999,38 @@ static int charger_fault_proc(struct charger_manager* data)
     return CHARGER_OK;
 }
 
+static void charger_fault_poll(struct charger_manager* data)
+{
+    struct charger_algo* algo = NULL;
+
+    /* finish a fault plot algorithm whose start is still in progress */
+
+    if (data->curr_charger == CHARGER_INDEX_INVAILD) {
+        return;
+    }
+
+    algo = &data->algos[data->curr_charger];
+    if (algo->start_pending && charger_chg_proc_algorun(algo, &data->desc.fault) < 0) {
+        charger_chg_proc_algostop(data);
+        charger_fault_proc(data);
+    }
+}
+
+static void charger_regulate_timer_update(struct charger_manager* data)
+{
+    /* the fast loop only runs in the states that drive an algorithm */
+
+    if (data->desc.regulate_interval_ms == 0) {
+        return;
+    }
+
+    if (data->currstate == CHARGER_STATE_CHG || data->currstate == CHARGER_STATE_FAULT) {
+        charger_timer_start(data->regulate_fd, data->desc.regulate_interval_ms);
+    } else {
+        charger_timer_stop(data->regulate_fd);
+    }
+}
+
 static void charger_fault_escape(struct charger_manager* data)
 {
     int ret;
@@ -449,13 +1047,15 @@ static int charger_state_fault(struct charger_manager* data, charger_msg_t* peve
 {
 
     if (NULL == pevent) {
-        clear_fault_timer_cnt(data);
+        clear_fault_timer(data);
+        invalidate_charger_shadow(data);
         return charger_fault_proc(data);
     }
 
     switch (pevent->event) {
     case CHARGER_EVENT_CHG_TIMEOUT:
-        if (check_battery_full(data)) {
+        if (update_battery_snapshot(data) < 0
+            || check_battery_full(data)) {
             data->nextstate = CHARGER_STATE_FULL;
         } else if (update_fault_timer(data)) {
             if (data->online) {
@@ -463,6 +1063,17 @@ static int charger_state_fault(struct charger_manager* data, charger_msg_t* peve
             } else {
                 data->nextstate = CHARGER_STATE_INIT;
             }
+        } else {
+            charger_fault_poll(data);
+        }
+        break;
+    case CHARGER_EVENT_POLL:
+        charger_fault_poll(data);
+        break;
+    case CHARGER_EVENT_REGULATE:
+        if (charger_regulate(data) < 0) {
+            charger_chg_proc_algostop(data);
+            charger_fault_proc(data);
         }
         break;
     case CHARGER_EVENT_OVERTEMP:
@@ -506,65 +1117,101 @@ void charger_sleep(void)
 #endif
 }
 
-void charger_delay(unsigned int delay_ms)
+void charger_cycle_init(struct charger_manager* manager)
+{
+    FILE* file;
+
+    manager->cycle_count = 0;
+    manager->cycle_charged = 0;
+    manager->cycle_capacity = -1;
+    manager->cycle_unsaved = 0;
+    if (CONFIG_CHARGERD_CYCLE_FILE_PATH[0] == '\0') {
+        return;
+    }
+
+    file = fopen(CONFIG_CHARGERD_CYCLE_FILE_PATH, "r");
+    if (file == NULL) {
+        chargerinfo("no battery cycle count in %s\n", CONFIG_CHARGERD_CYCLE_FILE_PATH);
+        return;
+    }
+    if (fscanf(file, "%d %d", &manager->cycle_count, &manager->cycle_charged) != 2) {
+        manager->cycle_count = 0;
+        manager->cycle_charged = 0;
+    }
+    fclose(file);
+    chargerinfo("battery cycle count %d\n", manager->cycle_count);
+}
+
+uint64_t charger_get_time_us(void)
 {
-    delay_lock = true;
-    usleep(1000 * delay_ms);
-    delay_lock = false;
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
 }
 
-int charger_timer_stop(timer_t* timer)
+int charger_timer_stop(int timerfd)
 {
+    struct itimerspec it;
     int ret;
 
-    if (*timer != 0) {
-        ret = timer_delete(*timer);
-        if (ret != 0) {
-            chargererr("timer_delete fail: %d\r\n", ret);
-            return -1;
-        } else {
-            *timer = 0;
-            chargerinfo("timer_delete success!\n");
-        }
-    } else {
-        chargerinfo("timer_create null!\n");
+    memset(&it, 0, sizeof(struct itimerspec));
+    ret = timerfd_settime(timerfd, 0, &it, NULL);
+    if (ret != 0) {
+        chargererr("timerfd_settime stop fail: %d\n", errno);
+        return -1;
     }
+    chargerinfo("timer stop success!\n");
     return 0;
 }
 
-int charger_timer_start(timer_t* timer, time_t poll_interval)
+int charger_timer_start(int timerfd, time_t poll_interval)
 {
     int ret;
-    struct sigevent evp;
     struct itimerspec it;
 
-    memset(&evp, 0, sizeof(struct sigevent));
-    evp.sigev_value.sival_int = 122;
-    evp.sigev_notify = SIGEV_THREAD;
-    evp.sigev_notify_function = (void*)charger_timer_cb;
-
     it.it_interval.tv_sec = poll_interval / 1000;
-    it.it_interval.tv_nsec = (poll_interval % 1000) * 1000;
-    it.it_value.tv_sec = poll_interval / 1000;
-    it.it_value.tv_nsec = (poll_interval % 1000) * 1000;
+    it.it_interval.tv_nsec = (poll_interval % 1000) * 1000000;
+    it.it_value = it.it_interval;
 
-    if (*timer != 0) {
-        chargererr("timer has created\r\n");
-        return 0;
-    }
-    ret = timer_create(CLOCK_REALTIME, &evp, timer);
+    ret = timerfd_settime(timerfd, 0, &it, NULL);
     if (ret != 0) {
-        chargererr("timer_create fail: %d\r\n", ret);
+        chargererr("timerfd_settime start fail: %d\n", errno);
         return -1;
     }
+    chargerinfo("timer start success!\n");
+    return 0;
+}
 
-    ret = timer_settime(*timer, 0, &it, 0);
+int charger_timer_defer(int timerfd, unsigned int delay_ms)
+{
+    int ret;
+    struct itimerspec it;
+    struct itimerspec old;
+
+    /* an earlier deadline already armed on the timer wins */
+
+    ret = timerfd_gettime(timerfd, &old);
+    if (ret == 0 && (old.it_value.tv_sec != 0 || old.it_value.tv_nsec != 0)
+        && (uint64_t)old.it_value.tv_sec * 1000 + old.it_value.tv_nsec / 1000000 <= delay_ms) {
+        return 0;
+    }
+
+    memset(&it, 0, sizeof(struct itimerspec));
+    it.it_value.tv_sec = delay_ms / 1000;
+    it.it_value.tv_nsec = (delay_ms % 1000) * 1000000;
+
+    /* a zero it_value disarms the timer, fire as soon as possible instead */
+
+    if (delay_ms == 0) {
+        it.it_value.tv_nsec = 1;
+    }
 
+    ret = timerfd_settime(timerfd, 0, &it, NULL);
     if (ret != 0) {
-        chargererr("timer_start fail: %d\r\n", ret);
+        chargererr("timerfd_settime defer fail: %d\n", errno);
         return -1;
     }
-    chargerinfo("timer_create success!\n");
     return 0;
 }
 
@@ -604,6 +1251,7 @@ int charger_statemachine_state_run(struct charger_manager* data,
         chargerinfo("change state %d to %d\n", data->currstate, data->nextstate);
         data->prestate = data->currstate;
         data->currstate = data->nextstate;
+        charger_regulate_timer_update(data);
     }
     return ret;
 }
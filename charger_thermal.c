@@ -0,0 +1,278 @@
+/*
+ * Copyright (C) 2023 Xiaomi Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+
+#include "charger_thermal.h"
+#include "charger_statemachine.h"
+#include <math.h>
+#include <sys/param.h>
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+
+static int charger_thermal_temp(struct charger_manager* manager, int sensor)
+{
+    return sensor == THERMAL_SENSOR_SKIN ? manager->skin_temp : manager->battery_temp;
+}
+
+static int charger_thermal_threshold(struct charger_manager* manager, int sensor)
+{
+    return sensor == THERMAL_SENSOR_SKIN ? manager->desc.temp_skin_max : manager->desc.temp_max;
+}
+
+static int charger_thermal_power(struct charger_manager* manager)
+{
+    if (manager->snapshot.current <= 0) {
+        return 0;
+    }
+    return (int64_t)manager->snapshot.voltage * manager->snapshot.current / 1000;
+}
+
+/* the time in seconds a unit of power acts on the temperature in horizon */
+
+static float charger_thermal_exposure(struct thermal_model* model, int horizon, float* decay)
+{
+    *decay = expf(-model->loss * horizon);
+    if (model->loss * horizon < 0.001f) {
+        return horizon;
+    }
+    return (1.0f - *decay) / model->loss;
+}
+
+static void charger_thermal_sample(struct thermal_model* model, float power, float rise, float dt, float dtemp)
+{
+    float phi[2] = { power * dt, -rise * dt };
+    float cphi[2];
+    float gain[2];
+    float denom;
+    float err;
+    int i;
+
+    cphi[0] = model->cov[0][0] * phi[0] + model->cov[0][1] * phi[1];
+    cphi[1] = model->cov[1][0] * phi[0] + model->cov[1][1] * phi[1];
+    denom = CHARGER_THERMAL_FORGET * CHARGER_THERMAL_NOISE + phi[0] * cphi[0] + phi[1] * cphi[1];
+    gain[0] = cphi[0] / denom;
+    gain[1] = cphi[1] / denom;
+
+    err = dtemp - model->gain * phi[0] - model->loss * phi[1];
+    model->gain += gain[0] * err;
+    model->loss += gain[1] * err;
+    for (i = 0; i < 2; i++) {
+        model->cov[i][0] = (model->cov[i][0] - gain[i] * cphi[0]) / CHARGER_THERMAL_FORGET;
+        model->cov[i][1] = (model->cov[i][1] - gain[i] * cphi[1]) / CHARGER_THERMAL_FORGET;
+    }
+
+    if (model->gain < 0.0f) {
+        model->gain = 0.0f;
+    }
+    if (model->loss < CHARGER_THERMAL_LOSS_MIN) {
+        model->loss = CHARGER_THERMAL_LOSS_MIN;
+    } else if (model->loss > CHARGER_THERMAL_LOSS_MAX) {
+        model->loss = CHARGER_THERMAL_LOSS_MAX;
+    }
+    model->samples++;
+}
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+/****************************************************************************
+ * Name: charger_thermal_init
+ *
+ * Description:
+ *   seed the thermal models and forget the history, the ambient is taken
+ *   from the first sample of the session
+ *
+ * Input Parameters:
+ *   manager - the struct charger_manager instance
+ ****************************************************************************/
+
+void charger_thermal_init(struct charger_manager* manager)
+{
+    struct thermal_model* model;
+    int sensor;
+
+    for (sensor = 0; sensor < THERMAL_SENSOR_MAX; sensor++) {
+        model = &manager->thermal[sensor];
+        memset(model, 0, sizeof(struct thermal_model));
+        model->gain = CHARGER_THERMAL_GAIN;
+        model->loss = CHARGER_THERMAL_LOSS;
+        model->cov[0][0] = CHARGER_THERMAL_VARIANCE;
+        model->cov[1][1] = CHARGER_THERMAL_VARIANCE;
+    }
+}
+
+/****************************************************************************
+ * Name: charger_thermal_update
+ *
+ * Description:
+ *   feed the temperatures and the charging power of this tick. Every
+ *   CHARGER_THERMAL_SAMPLE_MS the temperature step is fitted against the
+ *   power held since the last sample and the rise over ambient. The
+ *   ambient follows the lowest temperature seen in the session.
+ *
+ * Input Parameters:
+ *   manager - the struct charger_manager instance
+ ****************************************************************************/
+
+void charger_thermal_update(struct charger_manager* manager)
+{
+    struct thermal_model* model;
+    uint64_t now = charger_get_time_us();
+    int power = charger_thermal_power(manager);
+    float dt;
+    int sensor;
+    int temp;
+
+    for (sensor = 0; sensor < THERMAL_SENSOR_MAX; sensor++) {
+        model = &manager->thermal[sensor];
+        temp = charger_thermal_temp(manager, sensor);
+        if (!model->sampled) {
+            model->ambient = temp;
+        } else if (now - model->sample_us < CHARGER_THERMAL_SAMPLE_MS * 1000ULL) {
+            continue;
+        } else {
+            dt = (now - model->sample_us) / 1000000.0f;
+            charger_thermal_sample(model, model->power / 1000.0f,
+                (model->temp - model->ambient) / 10.0f, dt, (temp - model->temp) / 10.0f);
+            chargerdebug("thermal %d model rise %d/W tau %d s\n", sensor,
+                (int)(model->gain / model->loss * 10), (int)(1.0f / model->loss));
+        }
+
+        if (temp < model->ambient) {
+            model->ambient = temp;
+        }
+        model->temp = temp;
+        model->power = power;
+        model->sample_us = now;
+        model->sampled = true;
+    }
+}
+
+/****************************************************************************
+ * Name: charger_thermal_forecast
+ *
+ * Description:
+ *   forecast a temperature when the power is held for horizon seconds
+ *
+ * Input Parameters:
+ *   manager - the struct charger_manager instance
+ *   sensor - enum thermal_sensor
+ *   power - the charging power(mW)
+ *   horizon - the forecast horizon(s)
+ *
+ * Returned Value:
+ *    the temperature(0.1 Celsius)
+ ****************************************************************************/
+
+int charger_thermal_forecast(struct charger_manager* manager, int sensor, int power, int horizon)
+{
+    struct thermal_model* model = &manager->thermal[sensor];
+    float exposure;
+    float decay;
+    float rise;
+
+    if (!model->sampled) {
+        return charger_thermal_temp(manager, sensor);
+    }
+
+    exposure = charger_thermal_exposure(model, horizon, &decay);
+    rise = (model->temp - model->ambient) / 10.0f * decay + model->gain * power / 1000.0f * exposure;
+    return model->ambient + (int)(rise * 10);
+}
+
+/****************************************************************************
+ * Name: charger_thermal_limit
+ *
+ * Description:
+ *   the largest charge current that keeps the forecast of every sensor
+ *   margin below its over temperature threshold at the end of the
+ *   horizon, never below current_min so the reactive protection still
+ *   decides a full stop
+ *
+ * Input Parameters:
+ *   manager - the struct charger_manager instance
+ *
+ * Returned Value:
+ *    the current limit(mA), INT_MAX while no model is fitted or the
+ *    forecast is disabled
+ ****************************************************************************/
+
+int charger_thermal_limit(struct charger_manager* manager)
+{
+    struct charger_forecast_parameter* forecast = &manager->desc.forecast;
+    struct thermal_model* model;
+    int limit = INT_MAX;
+    float exposure;
+    float decay;
+    float power;
+    int current;
+    int sensor;
+
+    if (!forecast->enable || manager->snapshot.voltage <= 0) {
+        return INT_MAX;
+    }
+
+    for (sensor = 0; sensor < THERMAL_SENSOR_MAX; sensor++) {
+        model = &manager->thermal[sensor];
+        if (model->samples < CHARGER_THERMAL_MIN_SAMPLES || model->gain <= 0.0f) {
+            continue;
+        }
+
+        exposure = charger_thermal_exposure(model, forecast->horizon, &decay);
+        power = ((charger_thermal_threshold(manager, sensor) - forecast->margin - model->ambient) / 10.0f
+                    - (model->temp - model->ambient) / 10.0f * decay)
+            / (model->gain * exposure);
+        current = 0;
+        if (power > 0.0f) {
+            current = fminf(power * 1000000.0f / manager->snapshot.voltage, INT_MAX / 2);
+        }
+        current = MAX(current, forecast->current_min);
+        limit = MIN(limit, current);
+        chargerdebug("thermal %d allows %d mA\n", sensor, current);
+    }
+
+    return limit;
+}
+
+/****************************************************************************
+ * Name: charger_thermal_get_stats
+ *
+ * Description:
+ *   get the fitted thermal model of a sensor
+ *
+ * Input Parameters:
+ *   manager - the struct charger_manager instance
+ *   sensor - enum thermal_sensor
+ *   stats - the pointer to save the model
+ ****************************************************************************/
+
+void charger_thermal_get_stats(struct charger_manager* manager, int sensor, struct charger_thermal_stats* stats)
+{
+    struct thermal_model* model = &manager->thermal[sensor];
+
+    stats->time_constant = 1.0f / model->loss;
+    stats->rise = model->gain / model->loss * 10;
+    stats->forecast = charger_thermal_forecast(manager, sensor, charger_thermal_power(manager),
+        manager->desc.forecast.horizon);
+    stats->samples = model->samples;
+}
@@ -0,0 +1,253 @@
+/*
+ * Copyright (C) 2023 Xiaomi Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+
+#include "charger_desc.h"
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+/* the plot spans the temperature and voltage range of the example table */
+
+#define BENCH_TEMP_MIN -200
+#define BENCH_TEMP_MAX 600
+#define BENCH_VOL_MIN 3000
+#define BENCH_VOL_MAX 4500
+#define BENCH_PROTOCOL 3
+
+#define BENCH_SIZES (int)(sizeof(g_bench_sizes) / sizeof(g_bench_sizes[0]))
+
+#define BENCH_POINTS 4096
+#define BENCH_ROUNDS 64
+
+/****************************************************************************
+ * Private Types
+ ****************************************************************************/
+
+struct bench_point {
+    int temp;
+    int vol;
+};
+
+/****************************************************************************
+ * Private Data
+ ****************************************************************************/
+
+/* temperature x voltage bands, one row each */
+
+static const int g_bench_sizes[][2] = {
+    { 2, 4 },
+    { 4, 8 },
+    { 8, 16 },
+    { 16, 32 },
+    { 32, 64 },
+};
+
+static struct bench_point g_bench_points[BENCH_POINTS];
+static uint32_t g_bench_seed = 1;
+
+/* keeps the compiler from dropping the lookups */
+
+static volatile int g_bench_sink;
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+
+static int bench_random(int min, int max)
+{
+    g_bench_seed = g_bench_seed * 1103515245 + 12345;
+    return min + (int)((g_bench_seed >> 8) % (uint32_t)(max - min + 1));
+}
+
+static uint64_t bench_time_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int bench_plot_init(struct charger_desc* desc, int temps, int vols)
+{
+    struct charger_plot* plot = &desc->plot[0];
+    struct charger_plot_parameter* pa;
+    int t;
+    int v;
+
+    memset(desc, 0, sizeof(struct charger_desc));
+    plot->parameters = temps * vols;
+    plot->tlbs = calloc(plot->parameters, sizeof(struct charger_plot_parameter));
+    if (plot->tlbs == NULL) {
+        return -1;
+    }
+
+    for (t = 0; t < temps; t++) {
+        for (v = 0; v < vols; v++) {
+            pa = plot->tlbs + t * vols + v;
+            pa->temp_range_min = BENCH_TEMP_MIN + (BENCH_TEMP_MAX - BENCH_TEMP_MIN) * t / temps;
+            pa->temp_range_max = BENCH_TEMP_MIN + (BENCH_TEMP_MAX - BENCH_TEMP_MIN) * (t + 1) / temps - 1;
+            pa->vol_range_min = BENCH_VOL_MIN + (BENCH_VOL_MAX - BENCH_VOL_MIN) * v / vols;
+            pa->vol_range_max = BENCH_VOL_MIN + (BENCH_VOL_MAX - BENCH_VOL_MIN) * (v + 1) / vols - 1;
+            pa->axis_range_min = INT_MIN;
+            pa->axis_range_max = INT_MAX - 1;
+            pa->charger_index = 0;
+            pa->work_current = 100 + t * vols + v;
+        }
+    }
+
+    plot->mask = 1U << BENCH_PROTOCOL;
+    desc->plots = 1;
+    for (t = 0; t < MAX_PROTOCOLS; t++) {
+        desc->plot_by_protocol[t] = -1;
+    }
+    desc->plot_by_protocol[BENCH_PROTOCOL] = 0;
+    return charger_desc_index_plot(plot);
+}
+
+/* the lookup check_charger_plot did before the plots were compiled */
+
+static struct charger_plot_parameter* bench_linear_lookup(struct charger_desc* desc, int temp, int vol, int type)
+{
+    struct charger_plot_parameter* pa;
+    struct charger_plot* plot = NULL;
+    int i;
+
+    for (i = 0; i < desc->plots; i++) {
+        plot = &desc->plot[i];
+        if (plot->mask & (1 << type)) {
+            break;
+        }
+    }
+    if (i >= desc->plots) {
+        return NULL;
+    }
+
+    for (i = 0; i < plot->parameters; i++) {
+        pa = plot->tlbs + i;
+        if (temp >= pa->temp_range_min && temp <= pa->temp_range_max
+            && vol >= pa->vol_range_min && vol <= pa->vol_range_max) {
+            return pa;
+        }
+    }
+    return NULL;
+}
+
+static struct charger_plot_parameter* bench_index_lookup(struct charger_desc* desc, int temp, int vol, int type)
+{
+    struct charger_plot* plot;
+
+    plot = charger_desc_find_plot(desc, type);
+    if (plot == NULL) {
+        return NULL;
+    }
+    return charger_desc_lookup_plot(plot, temp, vol, 0);
+}
+
+static int bench_verify(struct charger_desc* desc)
+{
+    int mismatches = 0;
+    int i;
+
+    for (i = 0; i < BENCH_POINTS; i++) {
+        if (bench_index_lookup(desc, g_bench_points[i].temp, g_bench_points[i].vol, BENCH_PROTOCOL)
+            != bench_linear_lookup(desc, g_bench_points[i].temp, g_bench_points[i].vol, BENCH_PROTOCOL)) {
+            mismatches++;
+        }
+    }
+    return mismatches;
+}
+
+static uint64_t bench_run(struct charger_desc* desc, bool indexed)
+{
+    struct charger_plot_parameter* pa;
+    uint64_t start;
+    int sum = 0;
+    int round;
+    int i;
+
+    start = bench_time_ns();
+    for (round = 0; round < BENCH_ROUNDS; round++) {
+        for (i = 0; i < BENCH_POINTS; i++) {
+            if (indexed) {
+                pa = bench_index_lookup(desc, g_bench_points[i].temp, g_bench_points[i].vol, BENCH_PROTOCOL);
+            } else {
+                pa = bench_linear_lookup(desc, g_bench_points[i].temp, g_bench_points[i].vol, BENCH_PROTOCOL);
+            }
+            sum += pa != NULL ? pa->work_current : -1;
+        }
+    }
+    g_bench_sink = sum;
+    return (bench_time_ns() - start) / ((uint64_t)BENCH_ROUNDS * BENCH_POINTS);
+}
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+int main(void)
+{
+    struct charger_desc* desc;
+    uint64_t linear;
+    uint64_t indexed;
+    int ret = 0;
+    int i;
+
+    desc = malloc(sizeof(struct charger_desc));
+    if (desc == NULL) {
+        printf("alloc charger desc failed\n");
+        return -1;
+    }
+
+    /* a few points fall outside the table, both lookups return no row there */
+
+    for (i = 0; i < BENCH_POINTS; i++) {
+        g_bench_points[i].temp = bench_random(BENCH_TEMP_MIN - 10, BENCH_TEMP_MAX + 10);
+        g_bench_points[i].vol = bench_random(BENCH_VOL_MIN - 10, BENCH_VOL_MAX + 10);
+    }
+
+    printf("%6s %12s %12s %8s\n", "rows", "linear(ns)", "indexed(ns)", "speedup");
+    for (i = 0; i < BENCH_SIZES; i++) {
+        if (bench_plot_init(desc, g_bench_sizes[i][0], g_bench_sizes[i][1]) < 0) {
+            printf("build a plot of %d rows failed\n", g_bench_sizes[i][0] * g_bench_sizes[i][1]);
+            charger_desc_unit(desc);
+            ret = -1;
+            break;
+        }
+
+        if (bench_verify(desc) > 0) {
+            printf("rows %d: the lookups disagree\n", desc->plot[0].parameters);
+            ret = -1;
+        }
+
+        linear = bench_run(desc, false);
+        indexed = bench_run(desc, true);
+        printf("%6d %12" PRIu64 " %12" PRIu64 " %7.1fx\n", desc->plot[0].parameters,
+            linear, indexed, indexed > 0 ? (double)linear / indexed : 0.0);
+        charger_desc_unit(desc);
+    }
+
+    free(desc);
+    return ret;
+}
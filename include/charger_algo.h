@@ -22,6 +22,8 @@
  ****************************************************************************/
 
 #include "charger_desc.h"
+#include <stdbool.h>
+#include <stdint.h>
 
 /****************************************************************************
  * Public Types
@@ -42,18 +44,43 @@ enum {
     PUMP_CONF_STARTUP_VOLTAGE_OFFSET = 25,
     PUMP_CONF_VOL_PUMP_UP_LOCKED = 3450,
     PUMP_CONF_VOL_PUMP_DOWN_LOCKED = 3850,
+    PUMP_CONF_STARTUP_PROBE_MS = 100,
+    PUMP_CONF_STARTUP_ENABLE_MS = 500,
+    PUMP_CONF_SETTLE_BAND = 50,
+    PUMP_CONF_SETTLE_COUNT = 3,
 };
 
+/*
+ * start may return CHARGER_PENDING instead of blocking, the manager then
+ * calls poll on later ticks until it returns CHARGER_OK or fails. An algo
+ * whose start never returns CHARGER_PENDING can leave poll NULL.
+ *
+ * update applies a newly selected plot, regulate tracks the applied plot
+ * and runs on the fast regulation tick, or right after update when no
+ * regulate_interval_ms is configured. regulate may be NULL. Both may
+ * return CHARGER_PENDING after restarting the algo on their own, it is then
+ * polled like a start.
+ *
+ * An algo with battery_feedback regulates the battery current, the part of
+ * a sharing charger included. Any other one gets the row current less that
+ * part.
+ */
+
 struct charger_algo_ops {
     int (*start)(struct charger_algo* algo);
+    int (*poll)(struct charger_algo* algo);
     int (*update)(struct charger_algo* algo, struct charger_plot_parameter* pa);
+    int (*regulate)(struct charger_algo* algo);
     int (*stop)(struct charger_algo* algo);
+    bool battery_feedback;
 };
 
 struct charger_algo {
     struct charger_algo_ops* ops;
     void* cm;
     int index;
+    bool start_pending;
+    bool shared; // runs beside another algo, the supply is not its own
     struct charger_plot_parameter sp;
     void* priv;
 };
@@ -20,6 +20,7 @@
 /****************************************************************************
  * Included Files
  ****************************************************************************/
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -33,6 +34,10 @@
 #define MAX_PLOTS 5
 #define MAX_BUF_LEN 32
 #define MAX_RANGES 5
+#define MAX_PROTOCOLS 32
+#define CHARGER_PLOT_DIMS 3
+#define MAX_DERATING_POINTS 8
+#define MAX_FILTER_WINDOW 7
 
 /****************************************************************************
  * Public Types
@@ -45,6 +50,18 @@ struct battery_default_parameter {
     int vol;
 };
 
+enum charger_plot_axis {
+    CHARGER_PLOT_AXIS_NONE,
+    CHARGER_PLOT_AXIS_SOC,
+    CHARGER_PLOT_AXIS_CYCLE,
+};
+
+enum charger_plot_dim {
+    CHARGER_PLOT_DIM_TEMP,
+    CHARGER_PLOT_DIM_VOL,
+    CHARGER_PLOT_DIM_AXIS,
+};
+
 struct charger_plot_parameter {
     int temp_range_min;
     int temp_range_max;
@@ -53,12 +70,134 @@ struct charger_plot_parameter {
     int charger_index;
     int work_current; // mA
     int supply_vol;
+    int axis_range_min; // % or cycles, the whole axis without a third key
+    int axis_range_max;
+};
+
+/*
+ * The rows of a plot compiled into a temperature x voltage x axis grid.
+ * Every row bound is an edge, so every cell between neighbouring edges is
+ * covered by the same rows, the grid keeps the first of them, or -1. A
+ * plot without a third key has a single axis cell.
+ */
+
+struct charger_plot_index {
+    int* edges[CHARGER_PLOT_DIMS];
+    int cells[CHARGER_PLOT_DIMS];
+    int last_cell[CHARGER_PLOT_DIMS];
+    short* grid;
+};
+
+/* the charger a plot switches to when its own charger fails */
+
+struct charger_fallback {
+    int charger_index; // -1 without a fallback
+    int work_current; // mA
+    int supply_vol;
+};
+
+/*
+ * another charger taking a part of the current of the plot charger, its
+ * part shrinks from temp_start to zero at temp_max of the skin
+ */
+
+struct charger_sharing {
+    int charger_index; // -1 without sharing
+    int percent; // of the row current
+    int temp_start; // 0.1 Celsius
+    int temp_max; // 0.1 Celsius
 };
 
 struct charger_plot {
     struct charger_plot_parameter* tlbs;
     int parameters;
     unsigned int mask;
+    int axis;
+    int interpolation;
+    int current_step; // mA
+    struct charger_fallback fallback[MAX_CHARGERS];
+    unsigned int fallback_retry_ms;
+    struct charger_sharing sharing[MAX_CHARGERS];
+    struct charger_plot_index index;
+};
+
+/* gains are in 1/1000 mV per mA, applied once per regulation update */
+
+struct charger_regulator_parameter {
+    int enable;
+    int kp;
+    int ki;
+    int kd;
+    int step_inc_max; // mV
+    int step_dec_max; // mV
+    int settle_band; // mA
+};
+
+/* the charger ADC feeds the regulator, the gauge current cross-checks it */
+
+struct charger_adc_parameter {
+    int enable;
+    int tolerance; // mA
+    unsigned int mismatch_count;
+};
+
+/* the input current limit search on a sagging adapter */
+
+struct charger_aicl_parameter {
+    int enable;
+    int step_dec; // mA
+    int step_inc; // mA
+    int probe_interval_ms;
+    int current_min; // mA
+};
+
+struct charger_ir_parameter {
+    int enable;
+    int resistance; // mOhm, initial estimate
+    int resistance_min; // mOhm
+    int resistance_max; // mOhm
+    int compensation_max; // mV
+};
+
+struct derating_point {
+    int temp; // 0.1 Celsius
+    int percent;
+};
+
+/* piecewise linear, flat before the first and after the last point */
+
+struct charger_derating_curve {
+    struct derating_point points[MAX_DERATING_POINTS];
+    int num;
+};
+
+struct charger_derating_parameter {
+    int enable;
+    int current_step; // mA
+    struct charger_derating_curve battery;
+    struct charger_derating_curve skin;
+};
+
+enum charger_filter_signal {
+    CHARGER_FILTER_TEMP = 0,
+    CHARGER_FILTER_SKIN,
+    CHARGER_FILTER_VOLTAGE,
+    CHARGER_FILTER_CURRENT,
+    CHARGER_FILTER_MAX,
+};
+
+/* a median of 1 or less and an ema of 0 or 100 pass the samples through */
+
+struct charger_filter_parameter {
+    int median; // samples
+    int ema; // % weight of a new sample
+};
+
+struct charger_forecast_parameter {
+    int enable;
+    int horizon; // s
+    int margin; // 0.1 Celsius
+    int current_min; // mA
 };
 
 struct range_data {
@@ -83,10 +222,13 @@ struct charger_desc {
     int chargers;
     char fuel_gauge[MAX_BUF_LEN];
     unsigned int polling_interval_ms;
+    unsigned int regulate_interval_ms;
+    unsigned int telemetry_stale_ms;
     unsigned int fullbatt_capacity;
     int fullbatt_current;
     unsigned int fullbatt_duration_ms;
     unsigned int fault_duration_ms;
+    unsigned int fault_backoff_ms;
     int temp_min;
     int temp_min_r;
     int temp_max;
@@ -101,10 +243,18 @@ struct charger_desc {
     int vol_fall_hys;
     struct charger_plot plot[MAX_PLOTS];
     int plots;
+    int plot_by_protocol[MAX_PROTOCOLS];
     struct charger_plot_parameter fault;
     struct battery_default_parameter default_param;
     unsigned int enable_delay_ms;
     struct temp_vterm_plot temp_vterm;
+    struct charger_regulator_parameter regulator[MAX_CHARGERS];
+    struct charger_adc_parameter adc[MAX_CHARGERS];
+    struct charger_aicl_parameter aicl;
+    struct charger_ir_parameter ir;
+    struct charger_derating_parameter derating;
+    struct charger_forecast_parameter forecast;
+    struct charger_filter_parameter filter[CHARGER_FILTER_MAX];
 };
 
 /****************************************************************************
@@ -113,5 +263,10 @@ struct charger_desc {
 
 int charger_desc_init(struct charger_desc* desc);
 void charger_desc_unit(struct charger_desc* desc);
+int charger_desc_index_plot(struct charger_plot* plot);
+struct charger_plot* charger_desc_find_plot(struct charger_desc* desc, int type);
+struct charger_plot_parameter* charger_desc_lookup_plot(struct charger_plot* plot, int temp, int vol, int axis);
+int charger_desc_interpolate_plot(struct charger_plot* plot, struct charger_plot_parameter* pa,
+    int temp, int vol, int axis);
 
 #endif
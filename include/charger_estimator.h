@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2023 Xiaomi Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __CHARGER_ESTIMATOR_H
+#define __CHARGER_ESTIMATOR_H
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+
+#include "charger_manager.h"
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+/* a smaller current step is dominated by the gauge resolution */
+
+#define CHARGER_ESTIMATOR_MIN_STEP 50
+
+/* used when the configuration does not give them, in mOhm */
+
+#define CHARGER_ESTIMATOR_RESISTANCE 250
+#define CHARGER_ESTIMATOR_RESISTANCE_MIN 20
+#define CHARGER_ESTIMATOR_RESISTANCE_MAX 1000
+
+/* a sample weighs less than half after about 35 ticks */
+
+#define CHARGER_ESTIMATOR_FORGET 0.98f
+
+/* the seed is trusted to about 100 mOhm, a voltage step to about 5 mV */
+
+#define CHARGER_ESTIMATOR_VARIANCE 0.01f
+#define CHARGER_ESTIMATOR_NOISE 0.000025f
+
+/****************************************************************************
+ * Public Types
+ ****************************************************************************/
+
+struct charger_estimator_stats {
+    int resistance; // mOhm
+    int deviation; // mOhm
+    unsigned int accepted;
+    unsigned int rejected;
+};
+
+/****************************************************************************
+ * Public Function Prototypes
+ ****************************************************************************/
+
+void charger_estimator_init(struct charger_manager* manager);
+void charger_estimator_update(struct charger_manager* manager);
+int charger_estimator_ocv(struct charger_manager* manager);
+void charger_estimator_get_stats(struct charger_manager* manager, struct charger_estimator_stats* stats);
+#endif
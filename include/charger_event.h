@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2023 Xiaomi Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __CHARGER_EVENT_H
+#define __CHARGER_EVENT_H
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+
+#include "charger_manager.h"
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+/* must be a power of two */
+
+#define CHARGER_EVENT_RING_SIZE 32
+
+/* one batch holds a full ring plus one event of each kind from overflow */
+
+#define CHARGER_EVENT_BATCH_MAX (CHARGER_EVENT_RING_SIZE + 32)
+
+/****************************************************************************
+ * Public Types
+ ****************************************************************************/
+
+struct charger_event_stats {
+    unsigned int posted;
+    unsigned int overflows;
+    unsigned int coalesced;
+    uint32_t safety_latency_last_us;
+    uint32_t safety_latency_max_us;
+};
+
+/****************************************************************************
+ * Public Function Prototypes
+ ****************************************************************************/
+
+int charger_event_init(void);
+void charger_event_unit(void);
+int charger_event_post(const charger_msg_t* msg);
+void charger_event_ack(int fd);
+int charger_event_fetch(charger_msg_t* msgs, int max);
+int charger_event_order(charger_msg_t* msgs, int num);
+void charger_event_account(const charger_msg_t* msg);
+void charger_event_get_stats(struct charger_event_stats* stats);
+#endif
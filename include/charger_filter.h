@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2023 Xiaomi Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef __CHARGER_FILTER_H
+#define __CHARGER_FILTER_H
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+
+#include "charger_manager.h"
+
+/****************************************************************************
+ * Public Types
+ ****************************************************************************/
+
+struct charger_filter_stats {
+    unsigned int samples;
+    unsigned int raw_changes; // evaluations without the filter
+    unsigned int changes; // evaluations with the filter
+};
+
+/****************************************************************************
+ * Public Function Prototypes
+ ****************************************************************************/
+
+void charger_filter_init(struct charger_manager* manager);
+void charger_filter_reset(struct charger_manager* manager, int signal);
+int charger_filter_update(struct charger_manager* manager, int signal, int sample);
+void charger_filter_snapshot(struct charger_manager* manager);
+void charger_filter_get_stats(struct charger_manager* manager, int signal, struct charger_filter_stats* stats);
+#endif
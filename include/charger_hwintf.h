@@ -26,11 +26,38 @@
 #include <nuttx/power/battery_gauge.h>
 #include <nuttx/power/battery_ioctl.h>
 
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+/* the state bits of a charger, read by get_charger_state */
+
+#define BIT(n) (1U << (n))
+
+#define VBAT_OVP_MASK BIT(0)
+#define IBAT_OCP_MASK BIT(1)
+#define VBUS_OVP_MASK BIT(2)
+#define IBUS_OCP_MASK BIT(3)
+#define IBUS_UCP_MASK BIT(4)
+#define ADAPTER_INSERT_MASK BIT(5)
+#define VBAT_INSERT_MASK BIT(6)
+#define ADC_DONE_MASK BIT(7)
+#define VBUS_ERRORLO_STAT_MASK BIT(8)
+#define VBUS_ERRORHI_STAT_MASK BIT(9)
+#define CP_SWITCHING_STAT_MASK BIT(10)
+#define CHG_EN_STAT_MASK BIT(11)
+
+#define CHARGER_FAULT_MASK                                            \
+    (VBAT_OVP_MASK | IBAT_OCP_MASK | VBUS_OVP_MASK | IBUS_OCP_MASK    \
+        | IBUS_UCP_MASK | VBUS_ERRORLO_STAT_MASK | VBUS_ERRORHI_STAT_MASK)
+
 /****************************************************************************
  * Public Function Prototypes
  ****************************************************************************/
 
+void invalidate_charger_shadow(struct charger_manager* manager);
 int enable_adapter(struct charger_manager* manager, bool enable);
+bool is_adapter_settling(struct charger_manager* manager);
 int get_adapter_type(struct charger_manager* manager, int* type);
 int set_supply_voltage(struct charger_manager* manager, int vol);
 int get_supply_voltage(struct charger_manager* manager, int* vol);
@@ -38,11 +65,15 @@ int enable_charger(struct charger_manager* manager, int seq, bool enable);
 int set_charger_voltage(struct charger_manager* manager, int seq, int vol);
 int set_charger_current(struct charger_manager* manager, int seq, int current);
 int get_charger_state(struct charger_manager* manager, int seq, unsigned int* state);
+#ifdef CONFIG_CHARGERD_CHARGER_ADC
+int get_charger_adc(struct charger_manager* manager, int seq, struct charger_adc* adc);
+#endif
 int get_adapter_type_by_charger(struct charger_manager* manager, int* type);
 int get_battery_voltage(struct charger_manager* manager, int* voltage);
 int get_battery_capacity(struct charger_manager* manager, int* capacity);
 int get_battery_temp(struct charger_manager* manager, int* val);
 int get_battery_current(struct charger_manager* manager, int* cur);
+int get_battery_snapshot(struct charger_manager* manager, struct battery_snapshot* snapshot);
 int get_battery_status(struct charger_manager* manager, enum battery_status_e* state);
 int set_battery_vbus_state(struct charger_manager* manager, bool enable);
 #ifdef CONFIG_CHARGERD_SYNC_CHARGE_STATE
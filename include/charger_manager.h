@@ -26,7 +26,7 @@
 #include <debug.h>
 #include <errno.h>
 #include <fcntl.h>
-#include <mqueue.h>
+#include <limits.h>
 #include <nuttx/arch.h>
 #include <nuttx/config.h>
 #include <nuttx/wqueue.h>
@@ -37,6 +37,7 @@
 #include <sys/epoll.h>
 #include <sys/ioctl.h>
 #include <sys/time.h>
+#include <sys/timerfd.h>
 #include <syslog.h>
 #include <system/state.h>
 #include <time.h>
@@ -53,10 +54,9 @@
 
 #define CHARGER_INDEX_INVAILD -1
 #define CHARGER_FD_INVAILD -1
+#define CHARGER_SHADOW_INVAILD INT_MIN
 #define CHARGER_ALGO_BUCK 0
 #define LOG_TAG "[CHARGERD]"
-#define MQ_MSG_NAME "charger_events"
-#define MQ_MSG_LOAD_MAX (10)
 
 #define CHARGER_DEBUG_LOG_EN 0
 
@@ -95,6 +95,11 @@
         || ((left) <= (right) && (left) <= (value) \
             && (value) <= (right)))
 
+/* the gauge temperature has a filter of its own with the temp parameters */
+
+#define CHARGER_FILTER_GAUGE_TEMP CHARGER_FILTER_MAX
+#define CHARGER_FILTER_STATES (CHARGER_FILTER_MAX + 1)
+
 /****************************************************************************
  * Public Types
  ****************************************************************************/
@@ -104,12 +109,16 @@ struct charger_manager;
 enum CHARGER_RET_CODE {
     CHARGER_FAILED = -1,
     CHARGER_OK = 0,
+    CHARGER_PENDING = 1,
 };
 
 typedef enum {
     EVENT_HANDLER_HEALTHD,
     EVENT_HANDLER_THERMAL,
     EVENT_HANDLER_STATE,
+    EVENT_HANDLER_TIMER,
+    EVENT_HANDLER_DEFER,
+    EVENT_HANDLER_REGULATE,
     EVENT_HANDLER_MAX,
 } event_hanlder_e;
 
@@ -119,11 +128,14 @@ typedef enum {
     CHARGER_EVENT_CHG_TIMEOUT,
     CHARGER_EVENT_OVERTEMP,
     CHARGER_EVENT_OVERTEMP_RECOVERY,
+    CHARGER_EVENT_REGULATE,
+    CHARGER_EVENT_POLL,
 } charger_event_e;
 
 typedef struct {
     charger_event_e event;
     uint32_t time_gap;
+    uint64_t post_us;
 } charger_msg_t;
 
 typedef enum {
@@ -135,8 +147,166 @@ typedef enum {
     CHARGER_STATE_MAX,
 } charger_state_e;
 
+/* how a failure in the charging state is recovered from */
+
+typedef enum {
+    CHARGER_FAULT_NONE,
+    CHARGER_FAULT_RETRY,
+    CHARGER_FAULT_DERATE,
+    CHARGER_FAULT_FALLBACK,
+    CHARGER_FAULT_STOP,
+} charger_fault_e;
+
 typedef int (*state_func_t)(struct charger_manager* data, charger_msg_t* event);
 
+struct battery_snapshot {
+    int voltage; // mV
+    int current; // mA
+    int temp; // 0.1 Celsius
+    int capacity; // %
+    int resistance; // mOhm, estimated
+};
+
+/* the ADC of a charger, converted by the charger itself */
+
+struct charger_adc {
+    int vbus; // mV
+    int ibus; // mA
+    int vbat; // mV
+    int ibat; // mA
+};
+
+/* the last battery_state published by healthd, in snapshot units */
+
+struct battery_telemetry {
+    int voltage; // mV
+    int current; // mA
+    int capacity; // %
+    uint64_t update_us;
+    unsigned int seq;
+    unsigned int consumed;
+    unsigned int hits;
+    unsigned int misses;
+};
+
+/* the last values successfully written to the devices */
+
+struct charger_shadow {
+    int supply_vol;
+    int charger_vol[MAX_CHARGERS];
+    int charger_current[MAX_CHARGERS];
+    int charger_enable[MAX_CHARGERS];
+};
+
+/*
+ * what went wrong since the tick began, and the escalation of the faults
+ * until charging has run for fault_duration_ms since it last resumed
+ */
+
+struct charger_fault {
+    unsigned int state; // fault bits of the state read that failed an algo
+    int err; // errno of the last failed charger access
+    charger_fault_e type;
+    unsigned int retries;
+    unsigned int stops;
+    int derate; // % of the plot current
+    unsigned int duration_ms;
+    uint64_t fault_us;
+    uint64_t resume_us; // first charging tick after the last fault
+};
+
+/*
+ * the plot charger that failed and the one charging in its place until
+ * retry_us, when the plot charger is tried again
+ */
+
+struct charger_fallback_state {
+    int from;
+    int to;
+    int work_current; // mA
+    int supply_vol;
+    uint64_t retry_us;
+    struct charger_plot_parameter pa;
+};
+
+/*
+ * the second charger running beside the plot charger, the plot charger
+ * regulates the sum of both currents
+ */
+
+struct charger_sharing_state {
+    int primary; // CHARGER_INDEX_INVAILD while a charger runs alone
+    int secondary;
+    bool failed; // no sharing for the rest of the plug session
+    struct charger_plot_parameter pa;
+    struct charger_plot_parameter primary_pa; // the row less the shared part
+};
+
+/*
+ * the charging current an adapter could supply without its bus sagging,
+ * learned per charger and protocol and kept for the plug session
+ */
+
+struct input_current_limit {
+    int limit[MAX_CHARGERS][MAX_PROTOCOLS]; // mA, 0 until the bus sagged
+    uint64_t probe_us[MAX_CHARGERS];
+    uint64_t backoff_us[MAX_CHARGERS];
+};
+
+/*
+ * internal resistance tracked by recursive least squares on the voltage
+ * and current steps between ticks, excited is set by every setpoint write
+ */
+
+struct battery_estimator {
+    float resistance; // Ohm
+    float variance; // Ohm^2
+    int voltage;
+    int current;
+    bool sampled;
+    bool excited;
+    unsigned int accepted;
+    unsigned int rejected;
+};
+
+/* one filtered input signal, the counters compare raw and filtered changes */
+
+struct signal_filter {
+    int window[MAX_FILTER_WINDOW];
+    int num;
+    int pos;
+    int state; // 1/256 of the unit
+    int raw;
+    int value;
+    bool primed;
+    unsigned int samples;
+    unsigned int raw_changes;
+    unsigned int changes;
+};
+
+/*
+ * first order thermal model dT/dt = gain * P - loss * (T - ambient) of a
+ * temperature sensor, the parameters are tracked by recursive least squares
+ */
+
+enum thermal_sensor {
+    THERMAL_SENSOR_BATTERY = 0,
+    THERMAL_SENSOR_SKIN,
+    THERMAL_SENSOR_MAX,
+};
+
+struct thermal_model {
+    float gain; // Celsius / (W * s)
+    float loss; // 1 / s
+    float cov[2][2];
+    int ambient; // 0.1 Celsius
+    int temp; // 0.1 Celsius
+    int power; // mW
+    uint64_t sample_us;
+    bool sampled;
+    unsigned int samples;
+};
+
 /*manager*/
 struct charger_manager {
     struct charger_desc desc;
@@ -148,17 +318,35 @@ struct charger_manager {
     int adapter_fd;
     int charger_fd[MAX_CHARGERS];
     struct charger_algo algos[MAX_CHARGERS];
+    struct charger_shadow shadow;
+    struct input_current_limit aicl;
     int gauge_fd;
+    struct battery_snapshot snapshot;
+    struct battery_telemetry telemetry;
+    struct battery_estimator estimator;
+    struct thermal_model thermal[THERMAL_SENSOR_MAX];
+    struct signal_filter filter[CHARGER_FILTER_STATES];
     int skin_temp;
     int battery_temp;
     bool temp_protect_lock;
-    timer_t env_timer_id;
+    int timer_fd;
+    int defer_fd;
+    int regulate_fd;
+    uint64_t adapter_settle_us;
     state_func_t functables[CHARGER_STATE_MAX];
     int epollfd;
-    uint64_t fullbatt_timer_cnt;
-    uint64_t fault_timer_cnt;
+    uint64_t fullbatt_start_us;
+    uint64_t fullbatt_detect_us;
+    uint64_t fault_start_us;
+    struct charger_fault fault;
+    struct charger_fallback_state fallback;
+    struct charger_sharing_state sharing;
     int curr_charger;
     int protocol;
+    int cycle_count;
+    int cycle_charged; // % charged towards the next cycle
+    int cycle_capacity;
+    int cycle_unsaved; // % charged since the cycle file was written
 };
 
 /****************************************************************************
@@ -168,6 +356,7 @@ struct charger_manager {
 bool is_adapter_exist(void);
 bool is_supply_exist(void);
 struct charger_plot_parameter* check_charger_plot(int temp, int vol, int type);
+struct charger_plot_parameter* derate_charger_plot(struct charger_plot_parameter* pa);
 int update_battery_temperature(int temp);
 int send_charger_msg(charger_msg_t msg);
 #endif
@@ -33,9 +33,11 @@
 
 void charger_wakup(void);
 void charger_sleep(void);
-void charger_delay(unsigned int delay_ms);
-int charger_timer_stop(timer_t* timer);
-int charger_timer_start(timer_t* timer, time_t poll_interval);
+uint64_t charger_get_time_us(void);
+int charger_timer_stop(int timerfd);
+int charger_timer_start(int timerfd, time_t poll_interval);
+int charger_timer_defer(int timerfd, unsigned int delay_ms);
+void charger_cycle_init(struct charger_manager* manager);
 void init_state_func_tables(struct charger_manager* manager);
 int charger_statemachine_state_run(struct charger_manager* data,
     charger_msg_t* event, bool* changed);
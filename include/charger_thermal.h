@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2023 Xiaomi Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __CHARGER_THERMAL_H
+#define __CHARGER_THERMAL_H
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+
+#include "charger_manager.h"
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+/* the sensors move by 0.1 Celsius, a shorter period only fits quantisation */
+
+#define CHARGER_THERMAL_SAMPLE_MS 10000
+
+/* seeds for a rise of about 15 Celsius at 10 W with a 10 minutes constant */
+
+#define CHARGER_THERMAL_GAIN 0.0025f
+#define CHARGER_THERMAL_LOSS 0.0017f
+#define CHARGER_THERMAL_LOSS_MIN 0.0001f
+#define CHARGER_THERMAL_LOSS_MAX 0.05f
+
+/* a sample weighs less than half after about 140 samples */
+
+#define CHARGER_THERMAL_FORGET 0.995f
+#define CHARGER_THERMAL_VARIANCE 0.00001f
+#define CHARGER_THERMAL_NOISE 0.002f
+
+/* the seeds do not throttle, the fitted model does */
+
+#define CHARGER_THERMAL_MIN_SAMPLES 6
+
+/****************************************************************************
+ * Public Types
+ ****************************************************************************/
+
+struct charger_thermal_stats {
+    int time_constant; // s
+    int rise; // 0.1 Celsius per W, steady state
+    int forecast; // 0.1 Celsius
+    unsigned int samples;
+};
+
+/****************************************************************************
+ * Public Function Prototypes
+ ****************************************************************************/
+
+void charger_thermal_init(struct charger_manager* manager);
+void charger_thermal_update(struct charger_manager* manager);
+int charger_thermal_forecast(struct charger_manager* manager, int sensor, int power, int horizon);
+int charger_thermal_limit(struct charger_manager* manager);
+void charger_thermal_get_stats(struct charger_manager* manager, int sensor, struct charger_thermal_stats* stats);
+#endif